@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+namespace Bench
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* Bumped by the global operator new replacement in the benchmark translation unit */
+    inline std::atomic<uint64_t> allocations{0};
+
+    /* Keeps the optimizer from discarding benchmarked results */
+    template <typename T>
+    inline void keep(T &&value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    //
+    // [SECTION] Functions
+    //
+
+    /*
+        Runs fn until at least min_time has elapsed and prints ns/op, throughput (when
+        bytes_per_op is known) and heap allocations per op.
+    */
+    template <typename Fn>
+    void run(const std::string &name, size_t bytes_per_op, Fn &&fn, std::chrono::milliseconds min_time = std::chrono::milliseconds(300))
+    {
+        using Clock = std::chrono::steady_clock;
+
+        for (int i{}; i < 16; i++)
+            fn();
+
+        uint64_t iterations{};
+        uint64_t allocations_before{allocations.load(std::memory_order_relaxed)};
+        Clock::time_point start{Clock::now()};
+        Clock::duration elapsed{};
+
+        for (uint64_t batch{1}; elapsed < min_time; batch *= 2)
+        {
+            for (uint64_t i{}; i < batch; i++)
+                fn();
+
+            iterations += batch;
+            elapsed = Clock::now() - start;
+        }
+
+        double ns_per_op{std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(iterations)};
+        double allocations_per_op{static_cast<double>(allocations.load(std::memory_order_relaxed) - allocations_before) / static_cast<double>(iterations)};
+
+        if (bytes_per_op != 0)
+            std::printf("%-48s %12.1f ns/op %10.1f MB/s %8.2f allocs/op\n", name.c_str(), ns_per_op, static_cast<double>(bytes_per_op) * 1e3 / ns_per_op, allocations_per_op);
+        else
+            std::printf("%-48s %12.1f ns/op %10s      %8.2f allocs/op\n", name.c_str(), ns_per_op, "-", allocations_per_op);
+    }
+}
+
+/* Include in exactly one translation unit of a benchmark executable */
+#define BENCH_COUNT_ALLOCATIONS()                                       \
+    void *operator new(size_t size)                                     \
+    {                                                                   \
+        Bench::allocations.fetch_add(1, std::memory_order_relaxed);     \
+        if (void *p{std::malloc(size == 0 ? 1 : size)})                 \
+            return p;                                                   \
+        throw std::bad_alloc{};                                         \
+    }                                                                   \
+    void operator delete(void *p) noexcept { std::free(p); }            \
+    void operator delete(void *p, size_t) noexcept { std::free(p); }
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ldap.h>
+
+#include "windows-types.h"
+
+namespace Corpus
+{
+    //
+    // [SECTION] Types
+    //
+
+    struct Attribute
+    {
+        std::string name;
+        std::vector<std::string> values;
+    };
+
+    /* Well-known ACE trustees, relative RIDs are put under the domain SID */
+    enum class Trustee
+    {
+        DOMAIN_ADMINS,
+        ENTERPRISE_ADMINS,
+        ACCOUNT,
+        ADMINISTRATORS,
+        AUTHENTICATED_USERS,
+        SELF,
+        SYSTEM,
+    };
+
+    //
+    // [SECTION] Binary values
+    //
+
+    inline void appendUint16(std::string &output, uint16_t value)
+    {
+        output += static_cast<char>(value & 0xFF);
+        output += static_cast<char>(value >> 8);
+    }
+
+    inline void appendUint32(std::string &output, uint32_t value)
+    {
+        for (int i{}; i < 4; i++)
+            output += static_cast<char>((value >> (i * 8)) & 0xFF);
+    }
+
+    inline std::string sid(uint8_t authority, const std::vector<uint32_t> &sub_authorities)
+    {
+        std::string output;
+        output += static_cast<char>(1);
+        output += static_cast<char>(sub_authorities.size());
+        output.append(5, '\0');
+        output += static_cast<char>(authority);
+
+        for (uint32_t sub_authority : sub_authorities)
+            appendUint32(output, sub_authority);
+
+        return output;
+    }
+
+    /* S-1-5-21-x-y-z */
+    inline std::string domainSid(std::mt19937_64 &random)
+    {
+        return sid(5, {21, static_cast<uint32_t>(random()), static_cast<uint32_t>(random()), static_cast<uint32_t>(random())});
+    }
+
+    inline std::string accountSid(const std::string &domain, uint32_t rid)
+    {
+        std::string output{domain};
+        output[1] = static_cast<char>(output[1] + 1);
+        appendUint32(output, rid);
+        return output;
+    }
+
+    inline std::string trusteeSid(Trustee trustee, const std::string &domain, uint32_t account_rid)
+    {
+        switch (trustee)
+        {
+        case Trustee::DOMAIN_ADMINS:
+            return accountSid(domain, 512);
+        case Trustee::ENTERPRISE_ADMINS:
+            return accountSid(domain, 519);
+        case Trustee::ACCOUNT:
+            return accountSid(domain, account_rid);
+        case Trustee::ADMINISTRATORS:
+            return sid(5, {32, 544});
+        case Trustee::AUTHENTICATED_USERS:
+            return sid(5, {11});
+        case Trustee::SELF:
+            return sid(5, {10});
+        case Trustee::SYSTEM:
+            break;
+        }
+
+        return sid(5, {18});
+    }
+
+    inline std::string guid(std::mt19937_64 &random)
+    {
+        std::string output;
+        appendUint32(output, static_cast<uint32_t>(random()));
+        appendUint32(output, static_cast<uint32_t>(random()));
+        appendUint32(output, static_cast<uint32_t>(random()));
+        appendUint32(output, static_cast<uint32_t>(random()));
+        return output;
+    }
+
+    /*
+        Self-relative nTSecurityDescriptor laid out as in windows-types.h: owner, group and
+        a DACL of ace_count ACEs mixing plain and object ACEs, most of them on the usual
+        well-known trustees. A small pool of schema GUIDs keeps the object ACEs realistic.
+    */
+    inline std::string securityDescriptor(const std::string &domain, size_t ace_count, std::mt19937_64 &random)
+    {
+        static const std::vector<std::string> SCHEMA_GUIDS{[]
+                                                           {
+                                                               std::mt19937_64 guid_random{7};
+                                                               std::vector<std::string> guids;
+                                                               for (int i{}; i < 24; i++)
+                                                                   guids.push_back(guid(guid_random));
+                                                               return guids;
+                                                           }()};
+
+        uint32_t account_rid{1000 + static_cast<uint32_t>(random() % 100000)};
+
+        std::string dacl;
+        for (size_t i{}; i < ace_count; i++)
+        {
+            Trustee trustee{static_cast<Trustee>(random() % 7)};
+            std::string trustee_sid{trusteeSid(trustee, domain, account_rid)};
+            bool is_object_ace{random() % 3 != 0};
+
+            std::string ace;
+            if (is_object_ace)
+            {
+                uint32_t flags{static_cast<uint32_t>(1 + random() % 3)};
+                appendUint32(ace, 0x00000130);
+                appendUint32(ace, flags);
+                if (flags & 0x1)
+                    ace += SCHEMA_GUIDS[random() % SCHEMA_GUIDS.size()];
+                if (flags & 0x2)
+                    ace += SCHEMA_GUIDS[random() % SCHEMA_GUIDS.size()];
+            }
+            else
+                appendUint32(ace, random() % 2 ? 0x000F01FF : 0x00020094);
+
+            ace += trustee_sid;
+
+            ACE_Type type{is_object_ace ? (random() % 8 == 0 ? ACE_Type::ACCESS_DENIED_OBJECT_ACE_TYPE : ACE_Type::ACCESS_ALLOWED_OBJECT_ACE_TYPE)
+                                        : ACE_Type::ACCESS_ALLOWED_ACE_TYPE};
+
+            dacl += static_cast<char>(type);
+            dacl += static_cast<char>(random() % 2 ? 0x12 : 0x02);
+            appendUint16(dacl, static_cast<uint16_t>(sizeof(ACE_Header) + ace.size()));
+            dacl += ace;
+        }
+
+        std::string owner{trusteeSid(Trustee::DOMAIN_ADMINS, domain, account_rid)};
+        std::string group{trusteeSid(Trustee::DOMAIN_ADMINS, domain, account_rid)};
+
+        uint32_t owner_offset{sizeof(SecurityDescriptorRelative)};
+        uint32_t group_offset{owner_offset + static_cast<uint32_t>(owner.size())};
+        uint32_t dacl_offset{group_offset + static_cast<uint32_t>(group.size())};
+
+        std::string output;
+        output += static_cast<char>(1);
+        output += '\0';
+        appendUint16(output, 0x8C04);
+        appendUint32(output, owner_offset);
+        appendUint32(output, group_offset);
+        appendUint32(output, 0);
+        appendUint32(output, dacl_offset);
+        output += owner;
+        output += group;
+
+        output += static_cast<char>(4);
+        output += '\0';
+        appendUint16(output, static_cast<uint16_t>(sizeof(ACL) + dacl.size()));
+        appendUint16(output, static_cast<uint16_t>(ace_count));
+        appendUint16(output, 0);
+        output += dacl;
+
+        return output;
+    }
+
+    /* Decimal FILETIME somewhere in the last few years */
+    inline std::string filetime(std::mt19937_64 &random)
+    {
+        return std::to_string(133000000000000000ULL + random() % 1000000000000000ULL);
+    }
+
+    //
+    // [SECTION] Entries
+    //
+
+    inline std::vector<Attribute> user(const std::string &domain, const std::string &base_dn, uint32_t index, size_t ace_count, std::mt19937_64 &random)
+    {
+        std::string name{"user" + std::to_string(index)};
+        std::string dn{"CN=" + name + ",OU=Staff," + base_dn};
+
+        std::vector<std::string> groups;
+        for (uint64_t i{}, count{random() % 8}; i < count; i++)
+            groups.push_back("CN=Group" + std::to_string(random() % 5000) + ",OU=Groups," + base_dn);
+
+        return {
+            {"sAMAccountName", {name}},
+            {"displayName", {"User " + std::to_string(index)}},
+            {"distinguishedName", {dn}},
+            {"objectSid", {accountSid(domain, 1000 + index)}},
+            {"lastLogon", {filetime(random)}},
+            {"memberOf", groups},
+            {"userAccountControl", {random() % 4 ? "512" : "66048"}},
+            {"description", {"Synthetic account \"" + name + "\"\tgenerated for benchmarks"}},
+            {"nTSecurityDescriptor", {securityDescriptor(domain, ace_count, random)}},
+            {"objectClass", {"top", "person", "organizationalPerson", "user"}},
+        };
+    }
+
+    /* BER encoded SearchResultEntry, the protocol op as libldap hands it to ldap_get_dn_ber */
+    inline std::string encodeEntry(const std::string &dn, const std::vector<Attribute> &attributes)
+    {
+        BerElement *p_ber{ber_alloc_t(LBER_USE_DER)};
+        berval dn_value{dn.size(), const_cast<char *>(dn.data())};
+        ber_printf(p_ber, "t{O{", static_cast<ber_tag_t>(LDAP_RES_SEARCH_ENTRY), &dn_value);
+
+        for (const auto &attribute : attributes)
+        {
+            std::vector<berval> values;
+            for (const auto &value : attribute.values)
+                values.push_back({value.size(), const_cast<char *>(value.data())});
+            values.push_back({0, nullptr});
+
+            berval name{attribute.name.size(), const_cast<char *>(attribute.name.data())};
+            ber_printf(p_ber, "{O[W]}", &name, values.data());
+        }
+
+        ber_printf(p_ber, "}}");
+
+        berval encoded{};
+        ber_flatten2(p_ber, &encoded, 0);
+        std::string output(encoded.bv_val, encoded.bv_len);
+        ber_free(p_ber, 1);
+        return output;
+    }
+}
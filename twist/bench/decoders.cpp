@@ -0,0 +1,189 @@
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <ctime>
+#include <vector>
+#include <random>
+
+#include <ldap.h>
+
+#include "bench.h"
+#include "corpus.h"
+#include "suites.h"
+#include "object-search.h"
+#include "document.h"
+
+/* The stream based decoders object-search.h used before, kept as the baseline */
+namespace Legacy
+{
+    std::string parseFiletime(const struct berval *value)
+    {
+        std::string filetime_str(value->bv_val, value->bv_len);
+        uint64_t filetime{};
+        try
+        {
+            filetime = std::stoull(filetime_str);
+        }
+        catch (...)
+        {
+            return "Invalid";
+        }
+
+        if (filetime == 0 || filetime == 0x7FFFFFFFFFFFFFFF)
+            return "Never";
+
+        const uint64_t FILETIME_TO_UNIX_OFFSET{11644473600ULL};
+        uint64_t seconds{(filetime / 10000000ULL) - FILETIME_TO_UNIX_OFFSET};
+
+        std::time_t time{static_cast<std::time_t>(seconds)};
+        std::tm *tm{std::gmtime(&time)};
+
+        std::ostringstream oss;
+        oss << std::put_time(tm, "%Y-%m-%d %H:%M:%S UTC");
+        return oss.str();
+    }
+
+    std::string parseSid(const struct berval *value)
+    {
+        const uint8_t *sid{reinterpret_cast<uint8_t *>(value->bv_val)};
+
+        uint64_t authority = 0;
+        for (int i = 0; i < 6; i++)
+            authority = (authority << 8) | sid[2 + i];
+
+        std::ostringstream oss;
+        oss << "S-" << static_cast<int>(sid[0]) << "-" << authority;
+
+        for (int i = 0; i < sid[1]; i++)
+        {
+            int offset{8 + (i * 4)};
+            uint32_t subauth = sid[offset] | (sid[offset + 1] << 8) | (sid[offset + 2] << 16) | (sid[offset + 3] << 24);
+            oss << "-" << subauth;
+        }
+
+        return oss.str();
+    }
+
+    std::string parseGuid(const uint8_t *guid_data)
+    {
+        uint32_t data1{*reinterpret_cast<const uint32_t *>(guid_data)};
+        uint16_t data2{*reinterpret_cast<const uint16_t *>(guid_data + 4)};
+        uint16_t data3{*reinterpret_cast<const uint16_t *>(guid_data + 6)};
+
+        std::ostringstream guid_oss;
+        guid_oss << std::hex << std::setfill('0')
+                 << std::setw(8) << data1 << "-"
+                 << std::setw(4) << data2 << "-"
+                 << std::setw(4) << data3 << "-";
+
+        for (int j = 8; j < 10; j++)
+            guid_oss << std::setw(2) << static_cast<int>(guid_data[j]);
+
+        guid_oss << "-";
+
+        for (int j = 10; j < 16; j++)
+            guid_oss << std::setw(2) << static_cast<int>(guid_data[j]);
+
+        return guid_oss.str();
+    }
+}
+
+/* Checks the new decoders against the baseline before timing anything */
+bool Suites::verifyDecoders()
+{
+    std::mt19937_64 random{42};
+
+    for (int i{}; i < 100000; i++)
+    {
+        uint8_t sid[8 + 15 * 4];
+        sid[0] = 1;
+        sid[1] = static_cast<uint8_t>(random() % 16);
+        for (size_t j{2}; j < sizeof(sid); j++)
+            sid[j] = static_cast<uint8_t>(random());
+
+        berval sid_value{static_cast<ber_len_t>(8 + sid[1] * 4), reinterpret_cast<char *>(sid)};
+        if (ObjectSearch::parseSid(&sid_value) != Legacy::parseSid(&sid_value))
+        {
+            std::cerr << "[x] SID mismatch: " << ObjectSearch::parseSid(&sid_value) << std::endl;
+            return false;
+        }
+
+        if (ObjectSearch::parseGuid(sid + 8) != Legacy::parseGuid(sid + 8))
+        {
+            std::cerr << "[x] GUID mismatch: " << ObjectSearch::parseGuid(sid + 8) << std::endl;
+            return false;
+        }
+
+        /* Between 1970 and 9999, the range gmtime is guaranteed to agree on */
+        uint64_t filetime{116444736000000000ULL + random() % (2650467744000000000ULL - 116444736000000000ULL)};
+        std::string filetime_text{std::to_string(filetime)};
+        berval filetime_value{filetime_text.size(), filetime_text.data()};
+        if (ObjectSearch::parseFiletime(&filetime_value) != Legacy::parseFiletime(&filetime_value))
+        {
+            std::cerr << "[x] FILETIME mismatch: " << filetime_text << " " << ObjectSearch::parseFiletime(&filetime_value) << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Suites::benchDecoders()
+{
+    uint8_t sid[]{1, 5, 0, 0, 0, 0, 0, 5, 21, 0, 0, 0, 0x9A, 0x2B, 0x11, 0x6C, 0x45, 0xE3, 0x02, 0x7D, 0x11, 0x9F, 0xAA, 0x3E, 0x51, 0x04, 0, 0};
+    berval sid_value{sizeof(sid), reinterpret_cast<char *>(sid)};
+
+    uint8_t guid[16]{0xbf, 0x96, 0x79, 0xc0, 0x0d, 0xe6, 0x11, 0xd0, 0xa2, 0x85, 0x00, 0xaa, 0x00, 0x30, 0x49, 0xe2};
+
+    std::string filetime_text{"133497215190000000"};
+    berval filetime_value{filetime_text.size(), filetime_text.data()};
+
+    Bench::run("legacy parseSid", sizeof(sid), [&]
+               { Bench::keep(Legacy::parseSid(&sid_value)); });
+    Bench::run("parseSid", sizeof(sid), [&]
+               { Bench::keep(ObjectSearch::parseSid(&sid_value)); });
+    Bench::run("formatSid", sizeof(sid), [&]
+               {
+                   char buffer[ObjectSearch::SID_BUFFER_SIZE];
+                   Bench::keep(ObjectSearch::formatSid(sid, sizeof(sid), buffer)); });
+
+    Bench::run("legacy GUID formatting", sizeof(guid), [&]
+               { Bench::keep(Legacy::parseGuid(guid)); });
+    Bench::run("parseGuid", sizeof(guid), [&]
+               { Bench::keep(ObjectSearch::parseGuid(guid)); });
+    Bench::run("formatGuid", sizeof(guid), [&]
+               {
+                   char buffer[ObjectSearch::GUID_BUFFER_SIZE];
+                   ObjectSearch::formatGuid(guid, buffer);
+                   Bench::keep(buffer); });
+
+    Bench::run("legacy parseFiletime", filetime_text.size(), [&]
+               { Bench::keep(Legacy::parseFiletime(&filetime_value)); });
+    Bench::run("parseFiletime", filetime_text.size(), [&]
+               { Bench::keep(ObjectSearch::parseFiletime(&filetime_value)); });
+    Bench::run("formatFiletime", filetime_text.size(), [&]
+               {
+                   char buffer[ObjectSearch::FILETIME_BUFFER_SIZE];
+                   Bench::keep(ObjectSearch::formatFiletime(filetime_value.bv_val, filetime_value.bv_len, buffer)); });
+
+    std::mt19937_64 random{42};
+    std::string domain{Corpus::domainSid(random)};
+
+    Document::Document document;
+
+    for (size_t ace_count : {8, 300})
+    {
+        std::string descriptor{Corpus::securityDescriptor(domain, ace_count, random)};
+        berval descriptor_value{descriptor.size(), descriptor.data()};
+
+        Bench::run("parseSecurityDescriptor (" + std::to_string(ace_count) + " ACEs)", descriptor.size(), [&]
+                   {
+                       Bench::keep(ObjectSearch::parseSecurityDescriptor(&descriptor_value, document));
+                       document.clear(); });
+        Bench::run("parseSecurityDescriptor + toString (" + std::to_string(ace_count) + " ACEs)", descriptor.size(), [&]
+                   {
+                       Bench::keep(Document::Document::toString(ObjectSearch::parseSecurityDescriptor(&descriptor_value, document), 2));
+                       document.clear(); });
+    }
+}
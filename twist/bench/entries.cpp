@@ -0,0 +1,83 @@
+#include <string>
+#include <vector>
+#include <random>
+#include <memory>
+
+#include <ldap.h>
+
+#include "bench.h"
+#include "corpus.h"
+#include "suites.h"
+#include "descriptor-cache.h"
+#include "sid-table.h"
+#include "dump.h"
+#include "schemas.h"
+#include "json.h"
+
+namespace
+{
+    /* Encoded user entries sharing one domain, every one with its own descriptor */
+    std::vector<std::string> buildUsers(size_t count, size_t ace_count)
+    {
+        std::mt19937_64 random{42};
+        std::string domain{Corpus::domainSid(random)};
+
+        std::vector<std::string> entries;
+        for (size_t i{}; i < count; i++)
+        {
+            std::vector<Corpus::Attribute> attributes{Corpus::user(domain, "DC=bench,DC=local", static_cast<uint32_t>(i), ace_count, random)};
+            entries.push_back(Corpus::encodeEntry(attributes[2].values.front(), attributes));
+        }
+
+        return entries;
+    }
+
+    void benchUsers(const std::string &name, const std::vector<std::string> &entries, const Dump::Options &options)
+    {
+        const ObjectSearch::Entry users{Schemas::describe<Schemas::Users>()};
+
+        size_t total_bytes{};
+        for (const auto &entry : entries)
+            total_bytes += entry.size();
+
+        JSON::Writer writer{nullptr, 2};
+
+        /* One lap first so the cached variants are timed on their hit path */
+        for (const auto &entry : entries)
+        {
+            berval encoded{entry.size(), const_cast<char *>(entry.data())};
+            Dump::writeEncodedEntry(encoded, users, options, writer);
+            writer.take();
+        }
+
+        size_t index{};
+
+        Bench::run(name, total_bytes / entries.size(), [&]
+                   {
+                       const std::string &entry{entries[index++ % entries.size()]};
+                       berval encoded{entry.size(), const_cast<char *>(entry.data())};
+                       Bench::keep(Dump::writeEncodedEntry(encoded, users, options, writer));
+                       Bench::keep(writer.take()); });
+    }
+}
+
+void Suites::benchEntries()
+{
+    for (size_t ace_count : {8, 300})
+    {
+        std::vector<std::string> entries{buildUsers(1000, ace_count)};
+        std::string suffix{" (" + std::to_string(ace_count) + " ACEs)"};
+
+        benchUsers("user entry, no cache" + suffix, entries, {0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr});
+
+        DescriptorCache::Cache inline_cache{false};
+        benchUsers("user entry, descriptor cache" + suffix, entries, {0, &inline_cache, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr});
+
+        DescriptorCache::Cache table_cache{true};
+        benchUsers("user entry, descriptor table" + suffix, entries, {0, &table_cache, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr});
+
+        SidTable::Interner sid_table;
+        DescriptorCache::Cache sid_cache{false, &sid_table};
+        benchUsers("user entry, descriptor cache + SID table" + suffix, entries, {0, &sid_cache, &sid_table, nullptr, nullptr, nullptr, nullptr, nullptr});
+    }
+}
@@ -0,0 +1,15 @@
+#include "bench.h"
+#include "suites.h"
+
+BENCH_COUNT_ALLOCATIONS()
+
+int main()
+{
+    if (!Suites::verifyDecoders() || !Suites::verifyEscaping())
+        return 1;
+
+    Suites::benchDecoders();
+    Suites::benchSerialization();
+    Suites::benchEntries();
+    return 0;
+}
@@ -0,0 +1,910 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <random>
+
+#include <strings.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <ldap.h>
+
+#include "arguments.h"
+
+/*
+    Serves an LDIF directory (such as twist_generate_ldif output) over loopback with
+    just enough LDAPv3 for VolvulusTwist: anonymous or simple binds always succeed,
+    searches honour the paged results, SD flags and show deleted controls, and
+    responses can be slowed down to look like a remote DC (latency per response,
+    bandwidth cap, MaxPageSize). Attributes with more values than MaxValRange are sent
+    in ranges ("member;range=0-1499") as AD does. Entries with isDeleted: TRUE act as
+    tombstones and the root DSE reports the highest uSNChanged as highestCommittedUSN.
+    A share of searches can be refused as busy to exercise clients backing off.
+*/
+namespace
+{
+    //
+    // [SECTION] Types
+    //
+
+    struct Settings
+    {
+        std::chrono::milliseconds latency;
+        /* Bytes per second per connection, 0 for unlimited */
+        size_t bandwidth;
+        size_t max_page_size;
+        /* Percentage of searches answered busy (51), as an overloaded DC sheds load */
+        int busy_percent;
+        /* Values of one attribute sent at most per entry */
+        size_t max_value_range;
+    };
+
+    struct Attribute
+    {
+        std::string name;
+        std::vector<std::string> values;
+        /* PartialAttribute as sent on the wire */
+        std::string encoded;
+    };
+
+    struct Entry
+    {
+        std::string dn;
+        std::vector<Attribute> attributes;
+        bool is_deleted;
+    };
+
+    struct Filter
+    {
+        ber_tag_t tag;
+        std::string attribute;
+        std::string value;
+        std::vector<Filter> children;
+    };
+
+    enum : ber_tag_t
+    {
+        BIND_REQUEST = 0x60,
+        BIND_RESPONSE = 0x61,
+        UNBIND_REQUEST = 0x42,
+        SEARCH_REQUEST = 0x63,
+        SEARCH_RESULT_ENTRY = 0x64,
+        SEARCH_RESULT_DONE = 0x65,
+        CONTROLS = 0xA0,
+        FILTER_AND = 0xA0,
+        FILTER_OR = 0xA1,
+        FILTER_NOT = 0xA2,
+        FILTER_EQUALITY = 0xA3,
+        FILTER_GREATER_OR_EQUAL = 0xA5,
+        FILTER_PRESENT = 0x87,
+    };
+
+    const char *const PAGED_RESULTS_OID{"1.2.840.113556.1.4.319"};
+    const char *const SD_FLAGS_OID{"1.2.840.113556.1.4.801"};
+    const char *const SHOW_DELETED_OID{"1.2.840.113556.1.4.417"};
+
+    //
+    // [SECTION] Encoding
+    //
+
+    void appendLength(std::string &output, size_t length)
+    {
+        if (length < 0x80)
+        {
+            output += static_cast<char>(length);
+            return;
+        }
+
+        char bytes[sizeof(size_t)];
+        int count{};
+        for (; length != 0; length >>= 8)
+            bytes[count++] = static_cast<char>(length & 0xFF);
+
+        output += static_cast<char>(0x80 | count);
+        while (count > 0)
+            output += bytes[--count];
+    }
+
+    void appendTlv(std::string &output, ber_tag_t tag, const char *data, size_t size)
+    {
+        output += static_cast<char>(tag);
+        appendLength(output, size);
+        output.append(data, size);
+    }
+
+    void appendTlv(std::string &output, ber_tag_t tag, const std::string &content)
+    {
+        appendTlv(output, tag, content.data(), content.size());
+    }
+
+    void appendInteger(std::string &output, ber_tag_t tag, int64_t value)
+    {
+        char bytes[8];
+        int count{};
+        do
+        {
+            bytes[count++] = static_cast<char>(value & 0xFF);
+            value >>= 8;
+        } while (count < 8 && !((value == 0 && !(bytes[count - 1] & 0x80)) || (value == -1 && (bytes[count - 1] & 0x80))));
+
+        output += static_cast<char>(tag);
+        output += static_cast<char>(count);
+        while (count > 0)
+            output += bytes[--count];
+    }
+
+    std::string encodeAttribute(const std::string &name, const std::vector<std::string> &values)
+    {
+        std::string set;
+        for (const auto &value : values)
+            appendTlv(set, LBER_OCTETSTRING, value);
+
+        std::string content;
+        appendTlv(content, LBER_OCTETSTRING, name);
+        appendTlv(content, LBER_SET, set);
+
+        std::string output;
+        appendTlv(output, LBER_SEQUENCE, content);
+        return output;
+    }
+
+    std::string encodeMessage(ber_int_t message_id, const std::string &protocol_op, const std::string &controls = {})
+    {
+        std::string content;
+        appendInteger(content, LBER_INTEGER, message_id);
+        content += protocol_op;
+        if (!controls.empty())
+            appendTlv(content, CONTROLS, controls);
+
+        std::string output;
+        appendTlv(output, LBER_SEQUENCE, content);
+        return output;
+    }
+
+    std::string encodeResult(ber_tag_t tag, int result_code, const std::string &diagnostic = {})
+    {
+        std::string content;
+        appendInteger(content, LBER_ENUMERATED, result_code);
+        appendTlv(content, LBER_OCTETSTRING, "");
+        appendTlv(content, LBER_OCTETSTRING, diagnostic);
+
+        std::string output;
+        appendTlv(output, tag, content);
+        return output;
+    }
+
+    //
+    // [SECTION] Directory
+    //
+
+    bool equalsIgnoreCase(const std::string &a, const std::string &b)
+    {
+        return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+    }
+
+    bool endsWithIgnoreCase(const std::string &value, const std::string &suffix)
+    {
+        return value.size() >= suffix.size() && strncasecmp(value.data() + value.size() - suffix.size(), suffix.data(), suffix.size()) == 0;
+    }
+
+    std::string decodeBase64(const std::string &input)
+    {
+        std::string output;
+        uint32_t block{};
+        int bits{};
+
+        for (char c : input)
+        {
+            int value{};
+            if (c >= 'A' && c <= 'Z')
+                value = c - 'A';
+            else if (c >= 'a' && c <= 'z')
+                value = c - 'a' + 26;
+            else if (c >= '0' && c <= '9')
+                value = c - '0' + 52;
+            else if (c == '+')
+                value = 62;
+            else if (c == '/')
+                value = 63;
+            else
+                continue;
+
+            block = (block << 6) | static_cast<uint32_t>(value);
+            bits += 6;
+            if (bits >= 8)
+            {
+                bits -= 8;
+                output += static_cast<char>((block >> bits) & 0xFF);
+            }
+        }
+
+        return output;
+    }
+
+    /* Adds one "name: value" or "name:: base64" line to entry */
+    void addLine(Entry &entry, const std::string &line)
+    {
+        size_t colon{line.find(':')};
+        if (colon == std::string::npos)
+            return;
+
+        std::string name{line.substr(0, colon)};
+        bool is_base64{colon + 1 < line.size() && line[colon + 1] == ':'};
+        size_t value_start{line.find_first_not_of(' ', colon + (is_base64 ? 2 : 1))};
+        std::string value{value_start == std::string::npos ? "" : line.substr(value_start)};
+        if (is_base64)
+            value = decodeBase64(value);
+
+        if (equalsIgnoreCase(name, "dn"))
+        {
+            entry.dn = value;
+            return;
+        }
+
+        for (auto &attribute : entry.attributes)
+        {
+            if (equalsIgnoreCase(attribute.name, name))
+            {
+                attribute.values.push_back(std::move(value));
+                return;
+            }
+        }
+
+        entry.attributes.push_back({name, {std::move(value)}, {}});
+    }
+
+    bool loadLdif(const std::string &path, std::vector<Entry> &directory)
+    {
+        std::ifstream input(path, std::ios::binary);
+        if (!input)
+            return false;
+
+        Entry entry;
+        std::string line;
+        std::string pending;
+
+        auto finishEntry{[&]
+                         {
+                             if (!pending.empty())
+                                 addLine(entry, pending);
+                             pending.clear();
+
+                             if (!entry.dn.empty())
+                             {
+                                 for (auto &attribute : entry.attributes)
+                                 {
+                                     attribute.encoded = encodeAttribute(attribute.name, attribute.values);
+                                     if (equalsIgnoreCase(attribute.name, "isDeleted"))
+                                         entry.is_deleted = equalsIgnoreCase(attribute.values.front(), "TRUE");
+                                 }
+                                 directory.push_back(std::move(entry));
+                             }
+                             entry = {};
+                         }};
+
+        while (std::getline(input, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+
+            if (line.empty())
+                finishEntry();
+            else if (line[0] == '#')
+                continue;
+            else if (line[0] == ' ')
+                pending.append(line, 1, std::string::npos);
+            else
+            {
+                if (!pending.empty())
+                    addLine(entry, pending);
+                pending = line;
+            }
+        }
+
+        finishEntry();
+        return true;
+    }
+
+    /* What an incremental dump reads first: which DC this is and how far its USNs went */
+    Entry createRootDse(const std::vector<Entry> &directory)
+    {
+        long long highest_usn{};
+        for (const auto &entry : directory)
+            for (const auto &attribute : entry.attributes)
+                if (equalsIgnoreCase(attribute.name, "uSNChanged"))
+                    highest_usn = std::max(highest_usn, std::stoll(attribute.values.front()));
+
+        std::string naming_context{directory.empty() ? "" : directory.front().dn};
+
+        Entry root_dse{"", {}, false};
+        root_dse.attributes.push_back({"dsServiceName", {"CN=NTDS Settings,CN=MOCK,CN=Servers,CN=Default-First-Site-Name,CN=Sites,CN=Configuration," + naming_context}, {}});
+        root_dse.attributes.push_back({"highestCommittedUSN", {std::to_string(highest_usn)}, {}});
+        root_dse.attributes.push_back({"defaultNamingContext", {naming_context}, {}});
+
+        for (auto &attribute : root_dse.attributes)
+            attribute.encoded = encodeAttribute(attribute.name, attribute.values);
+
+        return root_dse;
+    }
+
+    //
+    // [SECTION] Requests
+    //
+
+    bool parseFilter(BerElement *p_ber, Filter &filter)
+    {
+        ber_len_t length{};
+        filter.tag = ber_peek_tag(p_ber, &length);
+
+        switch (filter.tag)
+        {
+        case FILTER_AND:
+        case FILTER_OR:
+        {
+            char *p_last{};
+            for (ber_tag_t tag{ber_first_element(p_ber, &length, &p_last)}; tag != LBER_DEFAULT; tag = ber_next_element(p_ber, &length, p_last))
+            {
+                filter.children.emplace_back();
+                if (!parseFilter(p_ber, filter.children.back()))
+                    return false;
+            }
+            return true;
+        }
+
+        case FILTER_NOT:
+            filter.children.emplace_back();
+            return ber_skip_tag(p_ber, &length) != LBER_DEFAULT && parseFilter(p_ber, filter.children.back());
+
+        case FILTER_EQUALITY:
+        case FILTER_GREATER_OR_EQUAL:
+        {
+            berval attribute{};
+            berval value{};
+            if (ber_scanf(p_ber, "{mm}", &attribute, &value) == LBER_ERROR)
+                return false;
+
+            filter.attribute.assign(attribute.bv_val, attribute.bv_len);
+            filter.value.assign(value.bv_val, value.bv_len);
+            return true;
+        }
+
+        case FILTER_PRESENT:
+        {
+            berval attribute{};
+            if (ber_scanf(p_ber, "m", &attribute) == LBER_ERROR)
+                return false;
+
+            filter.attribute.assign(attribute.bv_val, attribute.bv_len);
+            return true;
+        }
+
+        default:
+            /* Substrings, <=, approximate and extensible matches are not needed by the dump */
+            return false;
+        }
+    }
+
+    bool matches(const Filter &filter, const Entry &entry)
+    {
+        switch (filter.tag)
+        {
+        case FILTER_AND:
+            return std::all_of(filter.children.begin(), filter.children.end(), [&entry](const Filter &child)
+                               { return matches(child, entry); });
+        case FILTER_OR:
+            return std::any_of(filter.children.begin(), filter.children.end(), [&entry](const Filter &child)
+                               { return matches(child, entry); });
+        case FILTER_NOT:
+            return !matches(filter.children.front(), entry);
+        default:
+            break;
+        }
+
+        for (const auto &attribute : entry.attributes)
+        {
+            if (!equalsIgnoreCase(attribute.name, filter.attribute))
+                continue;
+
+            if (filter.tag == FILTER_PRESENT)
+                return true;
+
+            /* Only integers such as uSNChanged are compared */
+            if (filter.tag == FILTER_GREATER_OR_EQUAL)
+                return std::any_of(attribute.values.begin(), attribute.values.end(), [&filter](const std::string &value)
+                                   { return std::stoll(value) >= std::stoll(filter.value); });
+
+            return std::any_of(attribute.values.begin(), attribute.values.end(), [&filter](const std::string &value)
+                               { return equalsIgnoreCase(value, filter.value); });
+        }
+
+        return false;
+    }
+
+    struct SearchRequest
+    {
+        std::string base;
+        ber_int_t scope;
+        Filter filter;
+        std::vector<std::string> attributes;
+        bool is_paged{false};
+        size_t page_size{};
+        std::string cookie;
+        /* Owner 0x1, group 0x2, DACL 0x4, SACL 0x8 */
+        int sd_flags{0xF};
+        bool show_deleted{false};
+    };
+
+    bool parseControls(BerElement *p_ber, SearchRequest &request)
+    {
+        ber_len_t length{};
+        if (ber_peek_tag(p_ber, &length) != CONTROLS)
+            return true;
+
+        char *p_last{};
+        for (ber_tag_t tag{ber_first_element(p_ber, &length, &p_last)}; tag != LBER_DEFAULT; tag = ber_next_element(p_ber, &length, p_last))
+        {
+            berval oid{};
+            berval value{};
+            ber_int_t is_critical{};
+
+            if (ber_scanf(p_ber, "{m", &oid) == LBER_ERROR)
+                return false;
+            if (ber_peek_tag(p_ber, &length) == LBER_BOOLEAN && ber_scanf(p_ber, "b", &is_critical) == LBER_ERROR)
+                return false;
+            if (ber_peek_tag(p_ber, &length) == LBER_OCTETSTRING && ber_scanf(p_ber, "m", &value) == LBER_ERROR)
+                return false;
+            if (ber_scanf(p_ber, "}") == LBER_ERROR)
+                return false;
+
+            std::string name(oid.bv_val, oid.bv_len);
+            BerElement *p_value{ber_alloc_t(LBER_USE_DER)};
+            ber_init2(p_value, &value, LBER_USE_DER);
+
+            bool is_valid{true};
+            if (name == PAGED_RESULTS_OID)
+            {
+                ber_int_t page_size{};
+                berval cookie{};
+                is_valid = ber_scanf(p_value, "{im}", &page_size, &cookie) != LBER_ERROR;
+                request.is_paged = true;
+                request.page_size = static_cast<size_t>(std::max(0, page_size));
+                request.cookie.assign(cookie.bv_val != nullptr ? cookie.bv_val : "", cookie.bv_len);
+            }
+            else if (name == SD_FLAGS_OID)
+                is_valid = ber_scanf(p_value, "{i}", &request.sd_flags) != LBER_ERROR;
+            else if (name == SHOW_DELETED_OID)
+                request.show_deleted = true;
+
+            ber_free(p_value, 0);
+            if (!is_valid)
+                return false;
+        }
+
+        return true;
+    }
+
+    bool parseSearchRequest(BerElement *p_ber, SearchRequest &request)
+    {
+        berval base{};
+        ber_int_t deref{}, size_limit{}, time_limit{}, types_only{};
+
+        if (ber_scanf(p_ber, "{miiiib", &base, &request.scope, &deref, &size_limit, &time_limit, &types_only) == LBER_ERROR)
+            return false;
+        request.base.assign(base.bv_val != nullptr ? base.bv_val : "", base.bv_len);
+
+        if (!parseFilter(p_ber, request.filter))
+            return false;
+
+        BerVarray attributes{};
+        ber_len_t count{sizeof(BerValue)};
+        if (ber_scanf(p_ber, "M}", &attributes, &count, static_cast<ber_len_t>(0)) == LBER_ERROR)
+            return false;
+
+        for (ber_len_t i{}; i < count; i++)
+            request.attributes.emplace_back(attributes[i].bv_val, attributes[i].bv_len);
+        ber_memfree(attributes);
+
+        return parseControls(p_ber, request);
+    }
+
+    //
+    // [SECTION] Connections
+    //
+
+    class Session
+    {
+    public:
+        Session(int socket, const Settings &settings, const std::vector<Entry> &directory, const Entry &root_dse)
+            : socket(socket), settings(settings), directory(directory), root_dse(root_dse), bucket_time(std::chrono::steady_clock::now()) {}
+
+        ~Session()
+        {
+            close(socket);
+        }
+
+        void serve()
+        {
+            std::string message;
+
+            while (readMessage(message))
+            {
+                berval buffer{message.size(), message.data()};
+                BerElement *p_ber{ber_alloc_t(LBER_USE_DER)};
+                ber_init2(p_ber, &buffer, LBER_USE_DER);
+
+                bool keep_going{handle(p_ber)};
+                ber_free(p_ber, 0);
+
+                if (!keep_going)
+                    break;
+            }
+        }
+
+    private:
+        int socket;
+        const Settings &settings;
+        const std::vector<Entry> &directory;
+        const Entry &root_dse;
+        std::chrono::steady_clock::time_point bucket_time;
+        double bucket_bytes{};
+        std::minstd_rand busy_random{static_cast<unsigned>(socket)};
+
+        bool readExactly(char *data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t received{recv(socket, data, size, 0)};
+                if (received <= 0)
+                    return false;
+
+                data += received;
+                size -= static_cast<size_t>(received);
+            }
+
+            return true;
+        }
+
+        bool readMessage(std::string &message)
+        {
+            unsigned char header[2];
+            if (!readExactly(reinterpret_cast<char *>(header), 2) || header[0] != LBER_SEQUENCE)
+                return false;
+
+            message.assign(reinterpret_cast<char *>(header), 2);
+
+            size_t length{header[1]};
+            if (length & 0x80)
+            {
+                size_t count{length & 0x7F};
+                unsigned char bytes[8];
+                if (count == 0 || count > sizeof(bytes) || !readExactly(reinterpret_cast<char *>(bytes), count))
+                    return false;
+
+                message.append(reinterpret_cast<char *>(bytes), count);
+                length = 0;
+                for (size_t i{}; i < count; i++)
+                    length = (length << 8) | bytes[i];
+            }
+
+            size_t offset{message.size()};
+            message.resize(offset + length);
+            return readExactly(message.data() + offset, length);
+        }
+
+        /* Token bucket holding at most a quarter second of traffic */
+        void throttle(size_t size)
+        {
+            if (settings.bandwidth == 0)
+                return;
+
+            auto now{std::chrono::steady_clock::now()};
+            double capacity{static_cast<double>(settings.bandwidth) / 4};
+            bucket_bytes = std::min(capacity, bucket_bytes + std::chrono::duration<double>(now - bucket_time).count() * static_cast<double>(settings.bandwidth));
+            bucket_time = now;
+
+            bucket_bytes -= static_cast<double>(size);
+            if (bucket_bytes < 0)
+                std::this_thread::sleep_for(std::chrono::duration<double>(-bucket_bytes / static_cast<double>(settings.bandwidth)));
+        }
+
+        bool send(const std::string &data)
+        {
+            const size_t CHUNK_SIZE{16 << 10};
+
+            for (size_t offset{}; offset < data.size();)
+            {
+                size_t size{std::min(CHUNK_SIZE, data.size() - offset)};
+                throttle(size);
+
+                ssize_t sent{::send(socket, data.data() + offset, size, MSG_NOSIGNAL)};
+                if (sent <= 0)
+                    return false;
+
+                offset += static_cast<size_t>(sent);
+            }
+
+            return true;
+        }
+
+        /* Every response is delayed as if it crossed the link once more */
+        bool respond(const std::string &data)
+        {
+            if (settings.latency.count() > 0)
+                std::this_thread::sleep_for(settings.latency);
+
+            return send(data);
+        }
+
+        bool handle(BerElement *p_ber)
+        {
+            ber_int_t message_id{};
+            ber_len_t length{};
+
+            if (ber_scanf(p_ber, "{i", &message_id) == LBER_ERROR)
+                return false;
+
+            switch (ber_peek_tag(p_ber, &length))
+            {
+            case BIND_REQUEST:
+                return respond(encodeMessage(message_id, encodeResult(BIND_RESPONSE, LDAP_SUCCESS)));
+
+            case SEARCH_REQUEST:
+            {
+                SearchRequest request;
+                if (!parseSearchRequest(p_ber, request))
+                    return respond(encodeMessage(message_id, encodeResult(SEARCH_RESULT_DONE, 53, "Unsupported search request")));
+
+                return search(message_id, request);
+            }
+
+            case UNBIND_REQUEST:
+                return false;
+
+            default:
+                /* Abandon and anything else needs no answer here */
+                return true;
+            }
+        }
+
+        /* SD flags select which parts of a descriptor are returned, as AD does */
+        static std::string filterDescriptor(const std::string &descriptor, int sd_flags)
+        {
+            if ((sd_flags & 0xF) == 0xF || descriptor.size() < 20)
+                return descriptor;
+
+            std::string output{descriptor};
+            const int OFFSETS[4]{4, 8, 16, 12};
+
+            for (int part{}; part < 4; part++)
+                if (!(sd_flags & (1 << part)))
+                    memset(output.data() + OFFSETS[part], 0, 4);
+
+            /* SE_DACL_PRESENT, SE_SACL_PRESENT */
+            uint16_t control{static_cast<uint16_t>(static_cast<uint8_t>(output[2]) | static_cast<uint8_t>(output[3]) << 8)};
+            if (!(sd_flags & 0x4))
+                control &= ~0x0004;
+            if (!(sd_flags & 0x8))
+                control &= ~0x0010;
+            output[2] = static_cast<char>(control & 0xFF);
+            output[3] = static_cast<char>(control >> 8);
+
+            return output;
+        }
+
+        /* Whether name is among the requested attributes, with the first value of "name;range=<start>-*" when asked so */
+        static bool isRequested(const SearchRequest &request, const std::string &name, bool &has_range, size_t &range_start)
+        {
+            for (const auto &requested : request.attributes)
+            {
+                size_t separator{requested.find(';')};
+                if (!equalsIgnoreCase(requested.substr(0, separator), name))
+                    continue;
+
+                if (separator != std::string::npos && requested.size() > separator + 7 && strncasecmp(requested.data() + separator + 1, "range=", 6) == 0)
+                {
+                    has_range = true;
+                    range_start = std::stoull(requested.substr(separator + 7));
+                }
+                return true;
+            }
+
+            return false;
+        }
+
+        /* At most max_value_range values from range_start, named after the range they cover */
+        std::string encodeRange(const Attribute &attribute, size_t range_start)
+        {
+            if (range_start >= attribute.values.size())
+                return {};
+
+            size_t range_end{std::min(attribute.values.size(), range_start + settings.max_value_range)};
+            std::string name{attribute.name + ";range=" + std::to_string(range_start) + "-" +
+                             (range_end == attribute.values.size() ? std::string("*") : std::to_string(range_end - 1))};
+
+            return encodeAttribute(name, {attribute.values.begin() + static_cast<ptrdiff_t>(range_start), attribute.values.begin() + static_cast<ptrdiff_t>(range_end)});
+        }
+
+        std::string encodeEntry(ber_int_t message_id, const Entry &entry, const SearchRequest &request)
+        {
+            bool is_all{request.attributes.empty() || std::any_of(request.attributes.begin(), request.attributes.end(), [](const std::string &name)
+                                                                  { return name == "*"; })};
+
+            std::string attributes;
+            for (const auto &attribute : entry.attributes)
+            {
+                bool has_range{false};
+                size_t range_start{};
+                if (!isRequested(request, attribute.name, has_range, range_start) && !is_all)
+                    continue;
+
+                if (has_range || attribute.values.size() > settings.max_value_range)
+                    attributes += encodeRange(attribute, range_start);
+                else if ((request.sd_flags & 0xF) != 0xF && equalsIgnoreCase(attribute.name, "nTSecurityDescriptor"))
+                    attributes += encodeAttribute(attribute.name, {filterDescriptor(attribute.values.front(), request.sd_flags)});
+                else
+                    attributes += attribute.encoded;
+            }
+
+            std::string content;
+            appendTlv(content, LBER_OCTETSTRING, entry.dn);
+            appendTlv(content, LBER_SEQUENCE, attributes);
+
+            std::string protocol_op;
+            appendTlv(protocol_op, SEARCH_RESULT_ENTRY, content);
+            return encodeMessage(message_id, protocol_op);
+        }
+
+        /* The cookie is the directory position the next page starts scanning from */
+        bool search(ber_int_t message_id, const SearchRequest &request)
+        {
+            if (request.base.empty() && request.scope == LDAP_SCOPE_BASE)
+                return respond(encodeEntry(message_id, root_dse, request) + encodeMessage(message_id, encodeResult(SEARCH_RESULT_DONE, LDAP_SUCCESS)));
+
+            size_t position{};
+            if (request.cookie.size() == sizeof(uint64_t))
+            {
+                uint64_t cookie{};
+                memcpy(&cookie, request.cookie.data(), sizeof(cookie));
+                position = static_cast<size_t>(cookie);
+            }
+
+            if (settings.busy_percent > 0 && static_cast<int>(busy_random() % 100) < settings.busy_percent)
+                return respond(encodeMessage(message_id, encodeResult(SEARCH_RESULT_DONE, LDAP_BUSY, "Server busy")));
+
+            size_t limit{settings.max_page_size};
+            if (request.is_paged && request.page_size > 0)
+                limit = std::min(limit, request.page_size);
+
+            std::string response;
+            size_t count{};
+            bool is_truncated{false};
+
+            for (; position < directory.size(); position++)
+            {
+                const Entry &entry{directory[position]};
+                if ((entry.is_deleted && !request.show_deleted) || !endsWithIgnoreCase(entry.dn, request.base) || !matches(request.filter, entry) ||
+                    (request.scope == LDAP_SCOPE_BASE && !equalsIgnoreCase(entry.dn, request.base)))
+                    continue;
+
+                if (count == limit)
+                {
+                    is_truncated = true;
+                    break;
+                }
+
+                response += encodeEntry(message_id, entry, request);
+                count++;
+            }
+
+            int result_code{LDAP_SUCCESS};
+            std::string controls;
+
+            if (request.is_paged)
+            {
+                std::string cookie;
+                if (is_truncated)
+                {
+                    uint64_t next{position};
+                    cookie.assign(reinterpret_cast<const char *>(&next), sizeof(next));
+                }
+
+                std::string value_content;
+                appendInteger(value_content, LBER_INTEGER, 0);
+                appendTlv(value_content, LBER_OCTETSTRING, cookie);
+                std::string value;
+                appendTlv(value, LBER_SEQUENCE, value_content);
+
+                std::string control;
+                appendTlv(control, LBER_OCTETSTRING, PAGED_RESULTS_OID);
+                appendTlv(control, LBER_OCTETSTRING, value);
+                appendTlv(controls, LBER_SEQUENCE, control);
+            }
+            else if (is_truncated)
+                result_code = LDAP_SIZELIMIT_EXCEEDED;
+
+            response += encodeMessage(message_id, encodeResult(SEARCH_RESULT_DONE, result_code), controls);
+            return respond(response);
+        }
+    };
+}
+
+int main(int argc, char **argv)
+{
+    Arguments::Map arguments = {
+        {"-l", {Arguments::Type::STRING, true, std::nullopt}},
+        {"-sp", {Arguments::Type::INT, false, 3389}},
+        {"-lat", {Arguments::Type::INT, false, 0}},
+        {"-bw", {Arguments::Type::INT, false, 0}},
+        {"-mps", {Arguments::Type::INT, false, 1000}},
+        {"-busy", {Arguments::Type::INT, false, 0}},
+        {"-mvr", {Arguments::Type::INT, false, 1500}},
+    };
+
+    int return_code{Arguments::parse(argc, argv, arguments)};
+
+    if (return_code != 0)
+    {
+        std::cerr << "[x] Failed to parse arguments with error code " << return_code << std::endl;
+        return 1;
+    }
+
+    std::vector<Entry> directory;
+    std::string path{*Arguments::getValue<std::string>(arguments, "-l")};
+    if (!loadLdif(path, directory))
+    {
+        std::cerr << "[x] Failed to read " << path << std::endl;
+        return 1;
+    }
+
+    Settings settings{
+        std::chrono::milliseconds(std::max(0, Arguments::getValue<int>(arguments, "-lat").value_or(0))),
+        static_cast<size_t>(std::max(0, Arguments::getValue<int>(arguments, "-bw").value_or(0))) * 1024,
+        static_cast<size_t>(std::max(1, Arguments::getValue<int>(arguments, "-mps").value_or(1000))),
+        std::clamp(Arguments::getValue<int>(arguments, "-busy").value_or(0), 0, 100),
+        static_cast<size_t>(std::max(1, Arguments::getValue<int>(arguments, "-mvr").value_or(1500))),
+    };
+
+    int port{Arguments::getValue<int>(arguments, "-sp").value_or(3389)};
+
+    int listener{socket(AF_INET, SOCK_STREAM, 0)};
+    int enable{1};
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        std::cerr << "[x] Failed to listen on 127.0.0.1:" << port << std::endl;
+        return 1;
+    }
+
+    Entry root_dse{createRootDse(directory)};
+
+    std::cerr << "[*] Serving " << directory.size() << " entries on 127.0.0.1:" << port << std::endl;
+
+    while (true)
+    {
+        int client{accept(listener, nullptr, nullptr)};
+        if (client < 0)
+            continue;
+
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        std::thread([client, &settings, &directory, &root_dse]
+                    {
+                        Session session{client, settings, directory, root_dse};
+                        session.serve(); })
+            .detach();
+    }
+}
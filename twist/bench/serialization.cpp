@@ -0,0 +1,201 @@
+#include <string>
+#include <vector>
+#include <random>
+#include <iostream>
+
+#include <ldap.h>
+
+#include "bench.h"
+#include "corpus.h"
+#include "suites.h"
+#include "object-search.h"
+#include "escape.h"
+#include "document.h"
+#include "compression.h"
+#include "utils.h"
+#include "json.h"
+
+/* Checks every scanner the CPU runs against the scalar one, and the escapes themselves */
+bool Suites::verifyEscaping()
+{
+    const std::pair<std::string, std::string> CASES[]{
+        {"CN=\"A\\B\"", "CN=\\\"A\\\\B\\\""},
+        {std::string("\b\f\n\r\t\x01\x1f\x7f", 8), "\\b\\f\\n\\r\\t\\u0001\\u001f\x7f"},
+        {std::string("a\0b", 3), "a\\u0000b"},
+        {"Fran\xC3\xA7ois \xE2\x82\xAC \xF0\x9F\x98\x80", "Fran\xC3\xA7ois \xE2\x82\xAC \xF0\x9F\x98\x80"},
+        /* Stray continuation, overlong, surrogate, cut short */
+        {"\x80\xC0\xAF\xED\xA0\x80\xE2\x82", "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD"},
+    };
+
+    for (const auto &[input, expected] : CASES)
+    {
+        std::string output;
+        Escape::append(input.data(), input.size(), output);
+        if (output != expected)
+        {
+            std::cerr << "[x] Escape mismatch: " << output << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<Escape::Scanner> scanners{&Escape::scanScalar, Escape::scanner()};
+#if defined(__SSE2__)
+    scanners.push_back(&Escape::scanSse2);
+#endif
+#if defined(ESCAPE_HAS_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        scanners.push_back(&Escape::scanAvx2);
+#endif
+
+    auto matchesScalar{[&scanners](const std::string &input)
+                       {
+                           std::string expected;
+                           Escape::appendWith(&Escape::scanScalar, input.data(), input.size(), expected);
+                           for (Escape::Scanner scan : scanners)
+                           {
+                               std::string output;
+                               Escape::appendWith(scan, input.data(), input.size(), output);
+                               if (output != expected)
+                               {
+                                   std::cerr << "[x] Escape scanner mismatch: " << output << std::endl;
+                                   return false;
+                               }
+                           }
+                           return true;
+                       }};
+
+    /* Control characters well inside a full 16 and 32 byte chunk, not only in the scalar tail */
+    std::string chunked(96, 'a');
+    chunked[5] = '\x1f';
+    chunked[40] = '\x1f';
+    chunked[70] = '\0';
+    if (!matchesScalar(chunked))
+        return false;
+
+    /* Mostly ASCII with the odd special byte (every control character among them), at every length and alignment around the vector widths */
+    std::mt19937_64 random{42};
+    std::string alphabet{"abcdefghij,=\"\\\xC3\xA9\xE2\x82\xAC\xFF"};
+    for (int c{}; c < 0x20; c++)
+        alphabet += static_cast<char>(c);
+
+    for (int i{}; i < 20000; i++)
+    {
+        std::string input(random() % 100, 'x');
+        for (char &c : input)
+            if (random() % 8 == 0)
+                c = alphabet[random() % alphabet.size()];
+
+        if (!matchesScalar(input))
+            return false;
+    }
+
+    return true;
+}
+
+void Suites::benchSerialization()
+{
+    std::string plain(256, 'a');
+    std::string quoted;
+    for (int i{}; i < 32; i++)
+        quoted += "CN=\"Some\\Group\"\t,OU=x\n";
+
+    Bench::run("Utils::escapeJson (plain)", plain.size(), [&]
+               { Bench::keep(Utils::escapeJson(plain)); });
+    Bench::run("Utils::escapeJson (escapes)", quoted.size(), [&]
+               { Bench::keep(Utils::escapeJson(quoted)); });
+
+    std::string output;
+    output.reserve(1024);
+    Bench::run("JSON::Writer::escape (plain)", plain.size(), [&]
+               {
+                   output.clear();
+                   JSON::Writer::escape(plain, output);
+                   Bench::keep(output); });
+    Bench::run("JSON::Writer::escape (escapes)", quoted.size(), [&]
+               {
+                   output.clear();
+                   JSON::Writer::escape(quoted, output);
+                   Bench::keep(output); });
+
+    /* The values of a large group's member attribute, one after the other */
+    std::mt19937_64 member_random{42};
+    std::string members;
+    for (int i{}; i < 64; i++)
+        members += "CN=User " + std::to_string(member_random() % 100000) + ",OU=Accounts,OU=Corp,DC=bench,DC=local";
+
+    output.reserve(members.size() * 2);
+    Bench::run("Escape::appendWith scalar (member DNs)", members.size(), [&]
+               {
+                   output.clear();
+                   Escape::appendWith(&Escape::scanScalar, members.data(), members.size(), output);
+                   Bench::keep(output); });
+    Bench::run("Escape::append (member DNs)", members.size(), [&]
+               {
+                   output.clear();
+                   Escape::append(members.data(), members.size(), output);
+                   Bench::keep(output); });
+
+    /* A document shaped like a decoded user, as the dump used to build them */
+    std::mt19937_64 random{42};
+    std::string domain{Corpus::domainSid(random)};
+    auto attributes{Corpus::user(domain, "DC=bench,DC=local", 1, 0, random)};
+
+    auto build{[&attributes](Document::Document &document)
+               {
+                   Document::Value object{Document::Document::object()};
+                   for (const auto &attribute : attributes)
+                   {
+                       if (attribute.name == "nTSecurityDescriptor")
+                           continue;
+
+                       if (attribute.values.size() == 1)
+                           document.set(object, attribute.name, document.string(attribute.values.front()));
+                       else
+                       {
+                           Document::Value values{Document::Document::array()};
+                           for (const auto &value : attribute.values)
+                               document.push(values, document.string(value));
+                           document.set(object, attribute.name, values);
+                       }
+                   }
+                   return object;
+               }};
+
+    Document::Document document;
+    Document::Value object{build(document)};
+    std::string rendered{Document::Document::toString(object, 2)};
+
+    Document::Document scratch;
+    Bench::run("Document build (user, reused arena)", rendered.size(), [&]
+               {
+                   Bench::keep(build(scratch));
+                   scratch.clear(); });
+    Bench::run("Document::toString (user)", rendered.size(), [&]
+               { Bench::keep(Document::Document::toString(object, 2)); });
+    /* Each lap leaves the writer at the top level, so the next one starts a fresh document */
+    JSON::Writer reused_writer{nullptr, 2};
+    Bench::run("Document::write (user, reused writer)", rendered.size(), [&]
+               {
+                   Document::Document::write(object, reused_writer);
+                   Bench::keep(reused_writer.take()); });
+
+    /* A block of output.json as a compression worker gets it, users differing in names and SIDs */
+    std::string block;
+    for (uint32_t i{}; block.size() < Compression::Stream::BLOCK_BYTES; i++)
+    {
+        Document::Document user_document;
+        Document::Value user{Document::Document::object()};
+        for (const auto &attribute : Corpus::user(domain, "DC=bench,DC=local", i, 0, random))
+            if (attribute.name != "nTSecurityDescriptor" && !attribute.values.empty())
+                user_document.set(user, attribute.name, user_document.string(attribute.values.front()));
+        block += Document::Document::toString(user, 2);
+    }
+
+    for (int level : {1, 6})
+    {
+        std::string compressed{Compression::compressBlock(Compression::Format::GZIP, level, block)};
+        std::cout << "gzip level " << level << " block ratio: " << static_cast<double>(block.size()) / static_cast<double>(compressed.size()) << std::endl;
+        Bench::run("Compression::compressBlock (gzip " + std::to_string(level) + ")", block.size(), [&]
+                   { Bench::keep(Compression::compressBlock(Compression::Format::GZIP, level, block)); });
+    }
+}
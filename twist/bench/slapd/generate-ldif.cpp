@@ -0,0 +1,489 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+#include "arguments.h"
+#include "corpus.h"
+#include "object-search.h"
+
+/*
+    Writes an LDIF directory shaped like a small Active Directory domain to stdout:
+    a domainDNS root, nested OUs, GPOs linked to them, groups nested into each other,
+    users and computers members of those groups, and trusts. Binary attributes
+    (objectSid, objectGUID, nTSecurityDescriptor, securityIdentifier) follow the
+    layouts in windows-types.h. Output only depends on the object count and seed.
+*/
+namespace
+{
+    //
+    // [SECTION] Types
+    //
+
+    enum class Kind : uint64_t
+    {
+        USER,
+        COMPUTER,
+        GROUP,
+    };
+
+    struct Counts
+    {
+        size_t organizational_units;
+        size_t gpos;
+        size_t trusts;
+        size_t groups;
+        size_t computers;
+        size_t users;
+    };
+
+    /* splitmix64, cheap per-object streams so memberships can be recomputed in any order */
+    struct ObjectRandom
+    {
+        uint64_t state;
+
+        ObjectRandom(uint64_t seed, Kind kind, uint64_t index)
+            : state(seed * 0x9E3779B97F4A7C15ULL ^ (static_cast<uint64_t>(kind) << 56) ^ index) {}
+
+        uint64_t operator()()
+        {
+            uint64_t z{state += 0x9E3779B97F4A7C15ULL};
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+    };
+
+    class Output
+    {
+    public:
+        ~Output()
+        {
+            flush();
+        }
+
+        void line(const std::string &name, const std::string &value)
+        {
+            buffer += name;
+            buffer += ": ";
+            buffer += value;
+            buffer += '\n';
+        }
+
+        /* Binary values are base64 encoded ("name:: ...") */
+        void binary(const std::string &name, const std::string &value)
+        {
+            static const char ALPHABET[]{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+
+            buffer += name;
+            buffer += ":: ";
+
+            size_t i{};
+            for (; i + 3 <= value.size(); i += 3)
+            {
+                uint32_t block{static_cast<uint32_t>(static_cast<uint8_t>(value[i])) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(value[i + 1])) << 8 | static_cast<uint8_t>(value[i + 2])};
+                buffer += ALPHABET[(block >> 18) & 0x3F];
+                buffer += ALPHABET[(block >> 12) & 0x3F];
+                buffer += ALPHABET[(block >> 6) & 0x3F];
+                buffer += ALPHABET[block & 0x3F];
+            }
+
+            if (i < value.size())
+            {
+                uint32_t block{static_cast<uint32_t>(static_cast<uint8_t>(value[i])) << 16};
+                if (i + 1 < value.size())
+                    block |= static_cast<uint32_t>(static_cast<uint8_t>(value[i + 1])) << 8;
+
+                buffer += ALPHABET[(block >> 18) & 0x3F];
+                buffer += ALPHABET[(block >> 12) & 0x3F];
+                buffer += i + 1 < value.size() ? ALPHABET[(block >> 6) & 0x3F] : '=';
+                buffer += '=';
+            }
+
+            buffer += '\n';
+        }
+
+        void end()
+        {
+            buffer += '\n';
+            if (buffer.size() >= 1 << 20)
+                flush();
+        }
+
+        void flush()
+        {
+            fwrite(buffer.data(), 1, buffer.size(), stdout);
+            buffer.clear();
+        }
+
+    private:
+        std::string buffer;
+    };
+
+    class Generator
+    {
+    public:
+        Generator(size_t object_count, const std::string &domain, uint64_t seed)
+            : domain(domain), seed(seed), random(seed)
+        {
+            netbios = domain.substr(0, domain.find('.'));
+
+            /* One DC= per label, corp.example.com is DC=corp,DC=example,DC=com */
+            for (size_t start{};;)
+            {
+                size_t end{domain.find('.', start)};
+                base_dn += (base_dn.empty() ? "DC=" : ",DC=") + domain.substr(start, end - start);
+                if (end == std::string::npos)
+                    break;
+                start = end + 1;
+            }
+
+            counts.organizational_units = std::max<size_t>(1, object_count / 500);
+            counts.gpos = std::max<size_t>(1, object_count / 1000);
+            counts.trusts = 3;
+            counts.groups = std::max<size_t>(1, object_count / 10);
+            counts.computers = object_count / 5;
+
+            size_t fixed{3 + counts.organizational_units + counts.gpos + counts.trusts + counts.groups + counts.computers};
+            counts.users = object_count > fixed ? object_count - fixed : 1;
+
+            domain_sid = Corpus::domainSid(random);
+
+            /* Most objects inherit one of a few descriptors, a few carry large explicit DACLs */
+            for (size_t i{}; i < 48; i++)
+            {
+                size_t ace_count{i % 24 == 23 ? 300 : 8 + random() % 40};
+                descriptors.push_back(Corpus::securityDescriptor(domain_sid, ace_count, random));
+            }
+
+            for (size_t i{}; i < counts.gpos; i++)
+            {
+                std::string guid{Corpus::guid(random)};
+                gpo_names.push_back("{" + ObjectSearch::parseGuid(reinterpret_cast<const uint8_t *>(guid.data())) + "}");
+            }
+
+            for (size_t i{}; i < counts.organizational_units; i++)
+                organizational_unit_dns.push_back("OU=Unit" + std::to_string(i) + "," + (i == 0 ? base_dn : organizational_unit_dns[(i - 1) / 4]));
+
+            invertMemberships();
+        }
+
+        const Counts &getCounts() const
+        {
+            return counts;
+        }
+
+        void write()
+        {
+            writeDomain();
+            writeContainers();
+            writeGpos();
+            writeOrganizationalUnits();
+            writeGroups();
+            writeAccounts(Kind::USER, counts.users);
+            writeAccounts(Kind::COMPUTER, counts.computers);
+            writeTrusts();
+            output.flush();
+        }
+
+    private:
+        std::string domain;
+        std::string netbios;
+        std::string base_dn;
+        uint64_t seed;
+        std::mt19937_64 random;
+        Counts counts{};
+        std::string domain_sid;
+        std::vector<std::string> descriptors;
+        std::vector<std::string> gpo_names;
+        std::vector<std::string> organizational_unit_dns;
+        /* Members of each group, (kind << 32 | index) */
+        std::vector<std::vector<uint64_t>> members;
+        /* Objects get increasing uSNChanged in creation order, as on a freshly built DC */
+        uint64_t usn{4096};
+        Output output;
+
+        uint32_t rid(Kind kind, size_t index) const
+        {
+            switch (kind)
+            {
+            case Kind::GROUP:
+                return static_cast<uint32_t>(1100 + index);
+            case Kind::USER:
+                return static_cast<uint32_t>(1100 + counts.groups + index);
+            case Kind::COMPUTER:
+                break;
+            }
+
+            return static_cast<uint32_t>(1100 + counts.groups + counts.users + index);
+        }
+
+        std::string name(Kind kind, size_t index) const
+        {
+            switch (kind)
+            {
+            case Kind::GROUP:
+                return "Group" + std::to_string(index);
+            case Kind::USER:
+                return "user" + std::to_string(index);
+            case Kind::COMPUTER:
+                break;
+            }
+
+            return "WKS" + std::to_string(index);
+        }
+
+        std::string dn(Kind kind, size_t index) const
+        {
+            ObjectRandom object_random{seed, kind, index};
+            return "CN=" + name(kind, index) + "," + organizational_unit_dns[object_random() % organizational_unit_dns.size()];
+        }
+
+        /* Groups an object is a direct member of, nested groups only join lower numbered ones */
+        std::vector<size_t> memberOf(Kind kind, size_t index) const
+        {
+            ObjectRandom object_random{seed, kind, index};
+            object_random();
+
+            size_t candidates{kind == Kind::GROUP ? index : counts.groups};
+            size_t count{kind == Kind::USER ? 1 + object_random() % 6 : kind == Kind::COMPUTER ? 1 + object_random() % 2 : object_random() % 3};
+
+            std::vector<size_t> groups;
+            for (size_t i{}; i < count && candidates > 0; i++)
+            {
+                /* Skewed so a few groups end up with very large member lists */
+                size_t group{static_cast<size_t>(std::min(object_random() % candidates, object_random() % candidates))};
+                if (std::find(groups.begin(), groups.end(), group) == groups.end())
+                    groups.push_back(group);
+            }
+
+            return groups;
+        }
+
+        void invertMemberships()
+        {
+            members.resize(counts.groups);
+
+            auto invert{[this](Kind kind, size_t count)
+                        {
+                            for (size_t i{}; i < count; i++)
+                                for (size_t group : memberOf(kind, i))
+                                    members[group].push_back(static_cast<uint64_t>(kind) << 32 | i);
+                        }};
+
+            invert(Kind::GROUP, counts.groups);
+            invert(Kind::USER, counts.users);
+            invert(Kind::COMPUTER, counts.computers);
+        }
+
+        const std::string &descriptor()
+        {
+            /* Skewed towards the first descriptors, as inheritance makes a few very common */
+            size_t a{static_cast<size_t>(random() % descriptors.size())};
+            size_t b{static_cast<size_t>(random() % descriptors.size())};
+            return descriptors[std::min(a, b)];
+        }
+
+        void writeCommon(const std::string &dn_value)
+        {
+            output.line("dn", dn_value);
+            output.line("distinguishedName", dn_value);
+            output.binary("objectGUID", Corpus::guid(random));
+            output.line("uSNChanged", std::to_string(++usn));
+            output.binary("nTSecurityDescriptor", descriptor());
+        }
+
+        void writeDomain()
+        {
+            writeCommon(base_dn);
+            output.line("objectClass", "top");
+            output.line("objectClass", "domain");
+            output.line("objectClass", "domainDNS");
+            output.line("dc", netbios);
+            output.binary("objectSid", domain_sid);
+            output.end();
+        }
+
+        void writeContainers()
+        {
+            for (const std::string &dn_value : {"CN=System," + base_dn, "CN=Policies,CN=System," + base_dn})
+            {
+                writeCommon(dn_value);
+                output.line("objectClass", "top");
+                output.line("objectClass", "container");
+                output.line("cn", dn_value.substr(3, dn_value.find(',') - 3));
+                output.end();
+            }
+        }
+
+        void writeGpos()
+        {
+            for (size_t i{}; i < counts.gpos; i++)
+            {
+                writeCommon("CN=" + gpo_names[i] + ",CN=Policies,CN=System," + base_dn);
+                output.line("objectClass", "top");
+                output.line("objectClass", "container");
+                output.line("objectClass", "groupPolicyContainer");
+                output.line("cn", gpo_names[i]);
+                output.line("displayName", "Policy " + std::to_string(i));
+                output.line("gPCFileSysPath", "\\\\" + domain + "\\SysVol\\" + domain + "\\Policies\\" + gpo_names[i]);
+                output.end();
+            }
+        }
+
+        void writeOrganizationalUnits()
+        {
+            for (size_t i{}; i < counts.organizational_units; i++)
+            {
+                writeCommon(organizational_unit_dns[i]);
+                output.line("objectClass", "top");
+                output.line("objectClass", "organizationalUnit");
+                output.line("objectClass", "extensibleObject");
+                output.line("ou", "Unit" + std::to_string(i));
+                output.line("name", "Unit" + std::to_string(i));
+
+                std::string links;
+                for (uint64_t j{}, count{random() % 3}; j < count; j++)
+                    links += "[LDAP://cn=" + gpo_names[random() % gpo_names.size()] + ",cn=policies,cn=system," + base_dn + ";0]";
+                if (!links.empty())
+                    output.line("gPLink", links);
+
+                if (random() % 4 == 0)
+                    output.line("managedBy", dn(Kind::USER, random() % counts.users));
+
+                output.end();
+            }
+        }
+
+        void writeMemberOf(Kind kind, size_t index)
+        {
+            for (size_t group : memberOf(kind, index))
+                output.line("memberOf", dn(Kind::GROUP, group));
+        }
+
+        void writeGroups()
+        {
+            for (size_t i{}; i < counts.groups; i++)
+            {
+                writeCommon(dn(Kind::GROUP, i));
+                output.line("objectClass", "top");
+                output.line("objectClass", "group");
+                output.line("cn", name(Kind::GROUP, i));
+                output.line("sAMAccountName", name(Kind::GROUP, i));
+                output.line("displayName", name(Kind::GROUP, i));
+                output.line("description", "Synthetic group " + std::to_string(i));
+                output.binary("objectSid", Corpus::accountSid(domain_sid, rid(Kind::GROUP, i)));
+                /* The first groups stand for the protected ones (Domain Admins, ...) */
+                if (i < 4)
+                    output.line("adminCount", "1");
+
+                for (uint64_t member : members[i])
+                    output.line("member", dn(static_cast<Kind>(member >> 32), member & 0xFFFFFFFF));
+
+                writeMemberOf(Kind::GROUP, i);
+                output.end();
+            }
+        }
+
+        void writeAccounts(Kind kind, size_t count)
+        {
+            bool is_computer{kind == Kind::COMPUTER};
+
+            for (size_t i{}; i < count; i++)
+            {
+                std::string account_name{name(kind, i)};
+
+                writeCommon(dn(kind, i));
+                output.line("objectClass", "top");
+                output.line("objectClass", "person");
+                output.line("objectClass", "organizationalPerson");
+                output.line("objectClass", "user");
+                if (is_computer)
+                    output.line("objectClass", "computer");
+
+                output.line("cn", account_name);
+                output.line("sn", account_name);
+                output.line("sAMAccountName", is_computer ? account_name + "$" : account_name);
+                output.line("displayName", is_computer ? account_name : "User " + std::to_string(i));
+                output.binary("objectSid", Corpus::accountSid(domain_sid, rid(kind, i)));
+                output.line("lastLogon", random() % 10 == 0 ? "0" : Corpus::filetime(random));
+                output.line("userAccountControl", is_computer ? "4096" : random() % 8 == 0 ? "514" : "512");
+
+                if (is_computer)
+                {
+                    std::string host{account_name + "." + domain};
+                    output.line("servicePrincipalName", "HOST/" + account_name);
+                    output.line("servicePrincipalName", "HOST/" + host);
+                    output.line("servicePrincipalName", "RestrictedKrbHost/" + host);
+                    if (random() % 20 == 0)
+                        output.line("servicePrincipalName", "MSSQLSvc/" + host + ":1433");
+                }
+                else if (random() % 200 == 0)
+                    output.line("servicePrincipalName", "HTTP/app" + std::to_string(i) + "." + domain);
+
+                if (!is_computer && random() % 3 == 0)
+                    output.line("description", "Synthetic account " + account_name);
+
+                writeMemberOf(kind, i);
+                output.end();
+            }
+        }
+
+        void writeTrusts()
+        {
+            for (size_t i{}; i < counts.trusts; i++)
+            {
+                std::string partner{"partner" + std::to_string(i) + ".corp"};
+
+                writeCommon("CN=" + partner + ",CN=System," + base_dn);
+                output.line("objectClass", "top");
+                output.line("objectClass", "leaf");
+                output.line("objectClass", "trustedDomain");
+                output.line("cn", partner);
+                output.binary("securityIdentifier", Corpus::domainSid(random));
+                output.line("trustDirection", std::to_string(1 + i % 3));
+                output.line("trustType", "2");
+                output.line("trustAttributes", i % 2 ? "8" : "32");
+                output.end();
+            }
+        }
+    };
+}
+
+int main(int argc, char **argv)
+{
+    Arguments::Map arguments = {
+        {"-n", {Arguments::Type::INT, true, std::nullopt}},
+        {"-d", {Arguments::Type::STRING, false, std::string("bench.local")}},
+        {"-s", {Arguments::Type::INT, false, 1}},
+    };
+
+    int return_code{Arguments::parse(argc, argv, arguments)};
+
+    if (return_code != 0)
+    {
+        std::cerr << "[x] Failed to parse arguments with error code " << return_code << std::endl;
+        return 1;
+    }
+
+    int object_count{Arguments::getValue<int>(arguments, "-n").value_or(0)};
+    std::string domain{*Arguments::getValue<std::string>(arguments, "-d")};
+
+    if (object_count < 16 || domain.find('.') == std::string::npos)
+    {
+        std::cerr << "[x] Expected at least 16 objects and a dotted domain" << std::endl;
+        return 1;
+    }
+
+    Generator generator{static_cast<size_t>(object_count), domain, static_cast<uint64_t>(Arguments::getValue<int>(arguments, "-s").value_or(1))};
+    generator.write();
+
+    const Counts &counts{generator.getCounts()};
+    std::cerr << "[*] " << counts.users << " users, " << counts.computers << " computers, " << counts.groups << " groups, "
+              << counts.organizational_units << " OUs, " << counts.gpos << " GPOs, " << counts.trusts << " trusts" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+#!/usr/bin/env bash
+#
+# End-to-end dump benchmark against a local slapd loaded with generate-ldif output.
+#
+# Usage: bench/slapd/run.sh <build dir> [object count...]   (defaults to 10000 100000 1000000)
+#
+# Environment:
+#   SLAPD, SLAPADD      slapd binaries (default: found in PATH or /usr/sbin)
+#   SCHEMA_DIR          directory holding core.schema and cosine.schema
+#   MODULE_DIR          directory holding back_mdb when slapd is built modular
+#   PORT                port slapd listens on (default: 3890)
+#   TWIST_ARGS          extra VolvulusTwist arguments, e.g. "-c 4 -sdt" (not --stats, which the script sets)
+#   WORK_DIR            scratch directory (default: a fresh mktemp -d, removed on exit)
+#
+# Needs GNU time for the peak RSS. Prints one row per size: objects, entries fetched
+# (from the run's --stats, so it holds for any output format), wall time, entries/s and
+# peak RSS of VolvulusTwist.
+
+set -euo pipefail
+
+if [ $# -lt 1 ]; then
+    echo "[x] Usage: $0 <build dir> [object count...]" >&2
+    exit 1
+fi
+
+BUILD_DIR=$(realpath "$1")
+shift
+SIZES=("$@")
+if [ ${#SIZES[@]} -eq 0 ]; then
+    SIZES=(10000 100000 1000000)
+fi
+
+SCRIPT_DIR=$(dirname "$(realpath "$0")")
+SLAPD=${SLAPD:-$(command -v slapd || echo /usr/sbin/slapd)}
+SLAPADD=${SLAPADD:-$(command -v slapadd || echo /usr/sbin/slapadd)}
+PORT=${PORT:-3890}
+TWIST_ARGS=${TWIST_ARGS:-}
+TIME=${TIME:-/usr/bin/time}
+
+if [[ " $TWIST_ARGS " == *" --stats "* ]]; then
+    echo "[x] TWIST_ARGS cannot hold --stats, the entry count is read from the one this script writes" >&2
+    exit 1
+fi
+
+first_existing() {
+    for candidate in "$@"; do
+        if [ -e "$candidate" ]; then
+            dirname "$candidate"
+            return
+        fi
+    done
+}
+
+SCHEMA_DIR=${SCHEMA_DIR:-$(first_existing /etc/ldap/schema/core.schema /etc/openldap/schema/core.schema /usr/local/etc/openldap/schema/core.schema)}
+MODULE_DIR=${MODULE_DIR:-$(first_existing /usr/lib/ldap/back_mdb.la /usr/lib64/openldap/back_mdb.la /usr/lib/openldap/back_mdb.la /usr/libexec/openldap/back_mdb.la)}
+
+for tool in "$SLAPD" "$SLAPADD" "$TIME" "$BUILD_DIR/VolvulusTwist" "$BUILD_DIR/twist_generate_ldif"; do
+    if [ ! -x "$tool" ]; then
+        echo "[x] Missing $tool" >&2
+        exit 1
+    fi
+done
+
+if [ -z "$SCHEMA_DIR" ]; then
+    echo "[x] Could not find core.schema, set SCHEMA_DIR" >&2
+    exit 1
+fi
+
+if [ -z "${WORK_DIR:-}" ]; then
+    WORK_DIR=$(mktemp -d)
+    REMOVE_WORK_DIR=1
+fi
+
+SLAPD_PID=""
+
+cleanup() {
+    if [ -n "$SLAPD_PID" ]; then
+        kill "$SLAPD_PID" 2>/dev/null || true
+    fi
+    if [ -n "${REMOVE_WORK_DIR:-}" ]; then
+        rm -rf "$WORK_DIR"
+    fi
+}
+trap cleanup EXIT
+
+write_config() {
+    local directory=$1
+
+    {
+        if [ -n "$MODULE_DIR" ]; then
+            echo "modulepath $MODULE_DIR"
+            echo "moduleload back_mdb"
+        fi
+        echo "include $SCHEMA_DIR/core.schema"
+        echo "include $SCHEMA_DIR/cosine.schema"
+        echo "include $SCRIPT_DIR/ad.schema"
+        echo "pidfile $directory/slapd.pid"
+        echo "sizelimit unlimited"
+        echo "database mdb"
+        echo "maxsize 68719476736"
+        echo "suffix \"dc=bench,dc=local\""
+        echo "rootdn \"cn=admin,dc=bench,dc=local\""
+        echo "rootpw secret"
+        echo "directory $directory/db"
+        echo "index objectClass eq"
+    } >"$directory/slapd.conf"
+}
+
+wait_for_port() {
+    for _ in $(seq 1 100); do
+        if (echo >"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+
+    echo "[x] slapd did not start listening on $PORT" >&2
+    return 1
+}
+
+printf "%10s %10s %10s %12s %12s\n" "objects" "entries" "wall (s)" "entries/s" "peak RSS (MB)"
+
+for size in "${SIZES[@]}"; do
+    directory="$WORK_DIR/$size"
+    mkdir -p "$directory/db" "$directory/run"
+    write_config "$directory"
+
+    "$BUILD_DIR/twist_generate_ldif" -n "$size" >"$directory/directory.ldif" 2>/dev/null
+    "$SLAPADD" -q -f "$directory/slapd.conf" -l "$directory/directory.ldif"
+    rm -f "$directory/directory.ldif"
+
+    "$SLAPD" -f "$directory/slapd.conf" -h "ldap://127.0.0.1:$PORT/"
+    wait_for_port
+    SLAPD_PID=$(cat "$directory/slapd.pid")
+
+    # shellcheck disable=SC2086
+    (cd "$directory/run" && "$TIME" -f "%e %M" -o "$directory/time.txt" \
+        "$BUILD_DIR/VolvulusTwist" -u admin -p secret -d bench.local -h 127.0.0.1 -sp "$PORT" \
+        -b "cn=admin,dc=bench,dc=local" --stats "$directory/stats.json" $TWIST_ARGS >/dev/null)
+
+    read -r wall rss_kb <"$directory/time.txt"
+    # The first "entries" of the stats is fetch.entries
+    entries=$(grep -m 1 -o '"entries": [0-9]*' "$directory/stats.json" | grep -o '[0-9]*$' || echo 0)
+    awk -v objects="$size" -v entries="$entries" -v wall="$wall" -v rss="$rss_kb" \
+        'BEGIN { printf "%10d %10d %10.2f %12.0f %12.1f\n", objects, entries, wall, (wall > 0 ? entries / wall : 0), rss / 1024 }'
+
+    kill "$SLAPD_PID"
+    while kill -0 "$SLAPD_PID" 2>/dev/null; do
+        sleep 0.1
+    done
+    SLAPD_PID=""
+
+    rm -rf "$directory"
+done
@@ -0,0 +1,11 @@
+#pragma once
+
+/* One function per benchmark translation unit, run in order by main.cpp */
+namespace Suites
+{
+    bool verifyDecoders();
+    bool verifyEscaping();
+    void benchDecoders();
+    void benchSerialization();
+    void benchEntries();
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+#include <ldap.h>
+
+#include "connection.h"
+#include "stats.h"
+
+/*
+    Paging and concurrency shared by every search of a run, tuned AIMD-style from what
+    each page costs: the page size grows by a step while pages come back faster than
+    TARGET_LATENCY and halves when they are slower or the DC refuses one (busy, time or
+    admin limits), the number of concurrent searches halves on refusals and creeps back
+    up after a run of healthy pages. A page shorter than requested that is not the last
+    one reveals the server's MaxPageSize, which then caps the page size.
+*/
+namespace Adaptive
+{
+    //
+    // [SECTION] Types
+    //
+
+    constexpr int MIN_PAGE_SIZE{100};
+    constexpr int MAX_PAGE_SIZE{10000};
+    /* AD's default MaxPageSize */
+    constexpr int INITIAL_PAGE_SIZE{1000};
+    constexpr int PAGE_SIZE_STEP{250};
+    constexpr std::chrono::milliseconds TARGET_LATENCY{2000};
+    /* Healthy pages in a row before one more concurrent search is allowed */
+    constexpr int CONCURRENCY_PATIENCE{8};
+    constexpr int MAX_RETRIES{3};
+
+    //
+    // [SECTION] Functions
+    //
+
+    /* Result codes of a DC shedding load, the page is worth asking again with a smaller size */
+    inline bool isRefusal(int result_code)
+    {
+        return result_code == LDAP_BUSY || result_code == LDAP_UNAVAILABLE || result_code == LDAP_TIMELIMIT_EXCEEDED ||
+               result_code == LDAP_ADMINLIMIT_EXCEEDED;
+    }
+
+    //
+    // [SECTION] Controller
+    //
+
+    class Controller
+    {
+    public:
+        /* fixed_page_size > 0 disables page size adaptation, p_pool (when set) gets the concurrency limit, p_stats (when set) every page */
+        Controller(int fixed_page_size, Connection::Pool *p_pool, Stats::Collector *p_stats = nullptr)
+            : is_adaptive(fixed_page_size <= 0), page_size(fixed_page_size > 0 ? fixed_page_size : INITIAL_PAGE_SIZE), p_pool(p_pool),
+              p_stats(p_stats), start(std::chrono::steady_clock::now())
+        {
+            if (p_pool != nullptr)
+                concurrency = max_concurrency = p_pool->size();
+        }
+
+        int pageSize() const
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            return page_size;
+        }
+
+        /* A page of entries (bytes of BER) answered in latency, requested with requested_size */
+        void onPage(int requested_size, size_t entries, size_t bytes, std::chrono::steady_clock::duration latency, bool is_last)
+        {
+            if (p_stats != nullptr)
+                p_stats->onPage(entries, bytes, latency);
+
+            std::lock_guard<std::mutex> lock{mutex};
+            total_bytes += bytes;
+            total_entries += entries;
+            pages++;
+
+            if (!is_last && entries > 0 && static_cast<int>(entries) < requested_size)
+            {
+                server_limit = std::min(server_limit, static_cast<int>(entries));
+                page_size = std::min(page_size, server_limit);
+            }
+
+            if (latency > TARGET_LATENCY)
+            {
+                healthy_pages = 0;
+                if (is_adaptive)
+                    page_size = std::max(MIN_PAGE_SIZE, page_size / 2);
+                return;
+            }
+
+            /* Only a full page says anything about a larger one */
+            if (is_adaptive && !is_last && static_cast<int>(entries) >= requested_size)
+                page_size = std::min({page_size + PAGE_SIZE_STEP, server_limit, MAX_PAGE_SIZE});
+
+            if (++healthy_pages >= CONCURRENCY_PATIENCE && concurrency < max_concurrency)
+            {
+                healthy_pages = 0;
+                setConcurrency(concurrency + 1);
+            }
+        }
+
+        /* The DC refused a page (see isRefusal), backs off and tells whether to ask again, attempt counts from 1 */
+        bool onRefusal(int attempt)
+        {
+            if (p_stats != nullptr)
+                p_stats->onRefusal();
+
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                refusals++;
+                healthy_pages = 0;
+                if (is_adaptive)
+                    page_size = std::max(MIN_PAGE_SIZE, page_size / 2);
+                setConcurrency(std::max<size_t>(1, concurrency / 2));
+            }
+
+            if (attempt > MAX_RETRIES)
+                return false;
+
+            std::this_thread::sleep_for(std::chrono::seconds(1 << (attempt - 1)));
+            return true;
+        }
+
+        void report() const
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            double seconds{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()};
+
+            std::cout << "[*] " << pages << " pages, " << total_entries << " entries at "
+                      << std::fixed << std::setprecision(1) << total_bytes / seconds / (1 << 20) << " MiB/s, page size "
+                      << page_size << (is_adaptive ? "" : " (fixed)");
+            if (server_limit != MAX_PAGE_SIZE)
+                std::cout << " (server limit " << server_limit << ")";
+            if (max_concurrency > 1)
+                std::cout << ", " << concurrency << "/" << max_concurrency << " concurrent searches";
+            if (refusals > 0)
+                std::cout << ", " << refusals << " refused pages";
+            std::cout << std::endl;
+        }
+
+    private:
+        bool is_adaptive;
+        int page_size;
+        int server_limit{MAX_PAGE_SIZE};
+        Connection::Pool *p_pool;
+        Stats::Collector *p_stats;
+        size_t concurrency{1};
+        size_t max_concurrency{1};
+        int healthy_pages{};
+        size_t pages{};
+        size_t refusals{};
+        uint64_t total_bytes{};
+        uint64_t total_entries{};
+        std::chrono::steady_clock::time_point start;
+        mutable std::mutex mutex;
+
+        void setConcurrency(size_t count)
+        {
+            concurrency = count;
+            if (p_pool != nullptr)
+                p_pool->limit(count);
+        }
+    };
+}
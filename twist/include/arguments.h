@@ -33,7 +33,7 @@ namespace Arguments
     // [SECTION] Functions
     //
 
-    int parse(int argc, char **argv, Map &arguments)
+    inline int parse(int argc, char **argv, Map &arguments)
     {
         if (argc > 0)
         {
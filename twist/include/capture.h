@@ -0,0 +1,399 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ldap.h>
+
+namespace Capture
+{
+    //
+    // [SECTION] Types
+    //
+
+    /*
+        A capture file is a FileHeader followed by 8 byte aligned records, each a
+        RecordHeader, its payload and 1 to 8 bytes of padding. CLASS records name a class
+        id, ENTRY records hold the BER SearchResultEntry protocol op of one entry of that
+        class, exactly as Dump::writeEncodedEntry reads it. Entries of one class are in
+        received order.
+    */
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    };
+
+    enum class RecordKind : uint8_t
+    {
+        CLASS = 1,
+        ENTRY = 2,
+    };
+
+    struct RecordHeader
+    {
+        RecordKind kind;
+        uint8_t class_id;
+        uint16_t reserved;
+        uint32_t size;
+    };
+
+    inline constexpr char MAGIC[8]{'T', 'W', 'I', 'S', 'T', 'C', 'A', 'P'};
+    inline constexpr uint32_t VERSION{1};
+
+    //
+    // [SECTION] Functions
+    //
+
+    /* Never 0, lber NUL-terminates the last value of an entry just past its payload */
+    inline size_t paddingFor(size_t size)
+    {
+        return 8 - size % 8;
+    }
+
+    inline void appendTagLength(std::string &output, uint8_t tag, size_t length)
+    {
+        output += static_cast<char>(tag);
+
+        if (length < 0x80)
+        {
+            output += static_cast<char>(length);
+            return;
+        }
+
+        char bytes[sizeof(size_t)];
+        int count{};
+        for (; length != 0; length >>= 8)
+            bytes[count++] = static_cast<char>(length & 0xFF);
+
+        output += static_cast<char>(0x80 | count);
+        while (count > 0)
+            output += bytes[--count];
+    }
+
+    /* Reads the DER tag and length at offset and moves offset to the content, false when they overrun size */
+    inline bool readHeader(const uint8_t *data, size_t size, size_t &offset, size_t &length)
+    {
+        if (offset + 2 > size)
+            return false;
+
+        offset++;
+        length = data[offset++];
+
+        if (length & 0x80)
+        {
+            size_t count{length & 0x7F};
+            if (count == 0 || count > sizeof(size_t) || offset + count > size)
+                return false;
+
+            length = 0;
+            while (count-- > 0)
+                length = (length << 8) | data[offset++];
+        }
+
+        return length <= size - offset;
+    }
+
+    /*
+        Points value at the first value of attribute name in an encoded entry. This only
+        reads the buffer, unlike lber which NUL-terminates what it parses in place, so
+        captured bytes can still be copied verbatim afterwards.
+    */
+    inline bool findValue(const berval &encoded, const char *name, berval &value)
+    {
+        const uint8_t *data{reinterpret_cast<const uint8_t *>(encoded.bv_val)};
+        size_t size{encoded.bv_len};
+        size_t name_length{strlen(name)};
+        size_t offset{};
+        size_t length{};
+
+        /* SearchResultEntry, then the DN is skipped and the attribute list entered */
+        if (!readHeader(data, size, offset, length) || !readHeader(data, size, offset, length))
+            return false;
+        offset += length;
+        if (!readHeader(data, size, offset, length))
+            return false;
+
+        size_t end{offset + length};
+        while (offset < end)
+        {
+            if (!readHeader(data, size, offset, length))
+                return false;
+            size_t attribute_end{offset + length};
+
+            if (!readHeader(data, size, offset, length))
+                return false;
+            bool is_match{length == name_length && strncasecmp(reinterpret_cast<const char *>(data + offset), name, length) == 0};
+            offset += length;
+
+            if (is_match)
+            {
+                /* The value SET, then its first value */
+                if (!readHeader(data, size, offset, length) || offset >= attribute_end || !readHeader(data, size, offset, length))
+                    return false;
+
+                value = {length, const_cast<char *>(reinterpret_cast<const char *>(data + offset))};
+                return true;
+            }
+
+            offset = attribute_end;
+        }
+
+        return false;
+    }
+
+    /*
+        Re-frames the entry held by message as a SearchResultEntry op. The DN and the
+        attribute list bytes are copied as received, only the outer headers are rebuilt.
+    */
+    inline bool encodeEntry(LDAP *p_ldap, LDAPMessage *message, std::string &output)
+    {
+        BerElement *p_ber{};
+        berval dn{};
+
+        if (ldap_get_dn_ber(p_ldap, message, &p_ber, &dn) != LDAP_SUCCESS)
+        {
+            if (p_ber != nullptr)
+                ber_free(p_ber, 0);
+            return false;
+        }
+
+        /* ldap_get_dn_ber leaves the remaining bytes bounded to the attribute list */
+        ber_len_t attributes_size{};
+        ber_get_option(p_ber, LBER_OPT_BER_REMAINING_BYTES, &attributes_size);
+        ber_free(p_ber, 0);
+
+        /* The attribute SEQUENCE header directly follows the DN, in whatever length form the server chose */
+        const uint8_t *p_header{reinterpret_cast<const uint8_t *>(dn.bv_val + dn.bv_len)};
+        size_t header_size{2 + ((p_header[1] & 0x80) ? (p_header[1] & 0x7F) : 0u)};
+        const char *p_attributes{reinterpret_cast<const char *>(p_header + header_size)};
+
+        std::string dn_header;
+        appendTagLength(dn_header, LBER_OCTETSTRING, dn.bv_len);
+        std::string attributes_header;
+        appendTagLength(attributes_header, LBER_SEQUENCE, attributes_size);
+
+        output.clear();
+        appendTagLength(output, LDAP_RES_SEARCH_ENTRY, dn_header.size() + dn.bv_len + attributes_header.size() + attributes_size);
+        output += dn_header;
+        output.append(dn.bv_val, dn.bv_len);
+        output += attributes_header;
+        output.append(p_attributes, attributes_size);
+        return true;
+    }
+
+    //
+    // [SECTION] Recorder
+    //
+
+    /* Appends records to a capture file, safe to share between concurrent class searches */
+    class Recorder
+    {
+    public:
+        ~Recorder()
+        {
+            close();
+        }
+
+        bool open(const std::string &path)
+        {
+            p_file = fopen(path.c_str(), "wb");
+            if (p_file == nullptr)
+                return false;
+
+            has_failed = false;
+
+            FileHeader header{};
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = VERSION;
+            return fwrite(&header, sizeof(header), 1, p_file) == 1;
+        }
+
+        /* Syncs and closes the file, false when anything recorded did not make it there */
+        bool close()
+        {
+            if (p_file != nullptr)
+            {
+                if (fflush(p_file) != 0 || fsync(fileno(p_file)) != 0)
+                    has_failed = true;
+                if (fclose(p_file) != 0)
+                    has_failed = true;
+            }
+            p_file = nullptr;
+
+            return !has_failed;
+        }
+
+        /* True once a record could not be written */
+        bool failed()
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            return has_failed;
+        }
+
+        /* Returns the id the entries of this class are recorded under */
+        uint8_t beginClass(const char *name)
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            uint8_t class_id{next_class_id++};
+            write(RecordKind::CLASS, class_id, name, strlen(name));
+            return class_id;
+        }
+
+        void record(uint8_t class_id, LDAP *p_ldap, LDAPMessage *message)
+        {
+            thread_local std::string encoded;
+            if (encodeEntry(p_ldap, message, encoded))
+                append(class_id, encoded.data(), encoded.size());
+        }
+
+        /* Adds an already encoded entry, e.g. one copied from another capture */
+        void append(uint8_t class_id, const char *data, size_t size)
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            write(RecordKind::ENTRY, class_id, data, size);
+        }
+
+        /* Hands everything recorded so far to the kernel (not to the disk, see close()), e.g. at page boundaries */
+        void flush()
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (fflush(p_file) != 0)
+                has_failed = true;
+        }
+
+    private:
+        FILE *p_file{};
+        std::mutex mutex;
+        uint8_t next_class_id{};
+        bool has_failed{false};
+
+        void write(RecordKind kind, uint8_t class_id, const char *data, size_t size)
+        {
+            const char PADDING[8]{};
+            size_t padding{paddingFor(size)};
+
+            RecordHeader header{kind, class_id, 0, static_cast<uint32_t>(size)};
+            if (fwrite(&header, sizeof(header), 1, p_file) != 1 || fwrite(data, 1, size, p_file) != size || fwrite(PADDING, 1, padding, p_file) != padding)
+                has_failed = true;
+        }
+    };
+
+    //
+    // [SECTION] Reader
+    //
+
+    /* Maps a capture file and indexes its entries per class name */
+    class Reader
+    {
+    public:
+        struct Class
+        {
+            std::string name;
+            std::vector<berval> entries;
+        };
+
+        ~Reader()
+        {
+            if (p_data != nullptr)
+                munmap(p_data, size);
+        }
+
+        bool open(const std::string &path)
+        {
+            int file{::open(path.c_str(), O_RDONLY)};
+            if (file < 0)
+                return false;
+
+            struct stat status{};
+            if (fstat(file, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(FileHeader))
+            {
+                ::close(file);
+                return false;
+            }
+
+            size = static_cast<size_t>(status.st_size);
+            /* Private and writable, decoding writes into the entries (never back to the file) */
+            void *p_map{mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0)};
+            ::close(file);
+
+            if (p_map == MAP_FAILED)
+                return false;
+
+            p_data = static_cast<char *>(p_map);
+            madvise(p_data, size, MADV_SEQUENTIAL);
+
+            const FileHeader *p_header{reinterpret_cast<const FileHeader *>(p_data)};
+            if (memcmp(p_header->magic, MAGIC, sizeof(MAGIC)) != 0 || p_header->version != VERSION)
+                return false;
+
+            return index();
+        }
+
+        /* nullptr when the capture holds no search of that class */
+        const Class *find(const char *name) const
+        {
+            for (const auto &capture_class : classes)
+                if (capture_class.name == name)
+                    return &capture_class;
+
+            return nullptr;
+        }
+
+    private:
+        char *p_data{};
+        size_t size{};
+        std::vector<Class> classes;
+        /* Position in classes of each class id */
+        std::vector<size_t> class_indices;
+
+        bool index()
+        {
+            size_t offset{sizeof(FileHeader)};
+
+            while (offset + sizeof(RecordHeader) <= size)
+            {
+                RecordHeader header;
+                memcpy(&header, p_data + offset, sizeof(header));
+                offset += sizeof(header);
+
+                if (offset + header.size + paddingFor(header.size) > size)
+                {
+                    /* A recording cut short keeps everything before its last record */
+                    std::cerr << "[!] Capture file is truncated" << std::endl;
+                    break;
+                }
+
+                char *p_payload{p_data + offset};
+                offset += header.size + paddingFor(header.size);
+
+                if (header.kind == RecordKind::CLASS)
+                {
+                    if (class_indices.size() <= header.class_id)
+                        class_indices.resize(header.class_id + 1, SIZE_MAX);
+
+                    class_indices[header.class_id] = classes.size();
+                    classes.push_back({std::string(p_payload, header.size), {}});
+                }
+                else if (header.kind == RecordKind::ENTRY && header.class_id < class_indices.size() && class_indices[header.class_id] != SIZE_MAX)
+                    classes[class_indices[header.class_id]].entries.push_back({header.size, p_payload});
+                else
+                    return false;
+            }
+
+            return true;
+        }
+    };
+}
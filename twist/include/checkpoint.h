@@ -0,0 +1,185 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+
+#include "output.h"
+
+namespace Checkpoint
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* How far one class got, as of the last page fully written to disk */
+    struct Progress
+    {
+        bool is_done;
+        /* Size of the file the class is written to (output.json or its part file) */
+        uint64_t bytes;
+        /* Where its entries begin in that file, just past the opening bracket of its array */
+        uint64_t start;
+        /* JSON::Writer containers open at that point, true while still empty */
+        std::vector<bool> scopes;
+        /* Paged results cookie of the next page, empty once done */
+        std::string cookie;
+    };
+
+    //
+    // [SECTION] Functions
+    //
+
+    inline std::string toHex(const std::string &data)
+    {
+        const char *DIGITS{"0123456789abcdef"};
+        std::string output;
+        for (unsigned char c : data)
+        {
+            output += DIGITS[c >> 4];
+            output += DIGITS[c & 0xF];
+        }
+        return output;
+    }
+
+    inline std::string fromHex(const std::string &text)
+    {
+        auto digit{[](char c)
+                   { return c <= '9' ? c - '0' : c - 'a' + 10; }};
+
+        std::string output;
+        for (size_t i{}; i + 1 < text.size(); i += 2)
+            output += static_cast<char>(digit(text[i]) << 4 | digit(text[i + 1]));
+        return output;
+    }
+
+    /* Opens path for writing, cut back to p_progress->bytes when resuming or emptied otherwise */
+    inline bool openAt(Output::File &output, const std::string &path, const Progress *p_progress)
+    {
+        return output.open(path, p_progress != nullptr ? &p_progress->bytes : nullptr);
+    }
+
+    //
+    // [SECTION] Journal
+    //
+
+    /*
+        Progress of every class of a dump, rewritten (aside, then renamed) after each page
+        so it never claims more than what is on disk. Its layout names how the output was
+        being written, a journal is only resumed with the same layout.
+    */
+    class Journal
+    {
+    public:
+        /* Loads the journal at path when resuming, otherwise starts an empty one there */
+        bool open(const std::string &path, const std::string &layout, bool is_resuming)
+        {
+            this->path = path;
+            this->layout = layout;
+
+            if (!is_resuming)
+                return true;
+
+            std::ifstream input(path);
+            if (!input)
+            {
+                std::cerr << "[x] There is no checkpoint to resume from (" << path << ")" << std::endl;
+                return false;
+            }
+
+            std::string line;
+            std::getline(input, line);
+            if (line != "twist-checkpoint 2 " + layout)
+            {
+                std::cerr << "[x] " << path << " was written with another -c, --profile, --classes or version, resume with the same settings" << std::endl;
+                return false;
+            }
+
+            /* <class> <done> <bytes> <start> <scopes> <cookie> */
+            while (std::getline(input, line))
+            {
+                std::istringstream fields(line);
+                std::string name, scopes, cookie;
+                Progress progress{};
+
+                if (!(fields >> name >> progress.is_done >> progress.bytes >> progress.start >> scopes >> cookie))
+                    continue;
+
+                for (char scope : scopes)
+                    if (scope != '-')
+                        progress.scopes.push_back(scope == '1');
+                progress.cookie = cookie == "-" ? "" : fromHex(cookie);
+
+                classes[name] = progress;
+            }
+
+            return true;
+        }
+
+        /* A copy, the class keeps updating its own entry */
+        bool find(const std::string &name, Progress &progress) const
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            auto it{classes.find(name)};
+            if (it == classes.end())
+                return false;
+
+            progress = it->second;
+            return true;
+        }
+
+        void update(const std::string &name, const Progress &progress)
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            classes[name] = progress;
+            save();
+        }
+
+        /* The dump completed, there is nothing left to resume */
+        void remove()
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            classes.clear();
+            std::remove(path.c_str());
+        }
+
+    private:
+        std::string path;
+        std::string layout;
+        std::map<std::string, Progress> classes;
+        mutable std::mutex mutex;
+
+        void save()
+        {
+            std::string temporary_path{path + ".tmp"};
+            {
+                std::ofstream output(temporary_path, std::ios::trunc);
+                output << "twist-checkpoint 2 " << layout << '\n';
+
+                for (const auto &[name, progress] : classes)
+                {
+                    std::string scopes;
+                    for (bool is_empty : progress.scopes)
+                        scopes += is_empty ? '1' : '0';
+
+                    output << name << ' ' << progress.is_done << ' ' << progress.bytes << ' ' << progress.start << ' '
+                           << (scopes.empty() ? "-" : scopes) << ' ' << (progress.cookie.empty() ? "-" : toHex(progress.cookie)) << '\n';
+                }
+
+                if (!output.flush())
+                {
+                    std::cerr << "[!] Failed to write checkpoint " << temporary_path << std::endl;
+                    return;
+                }
+            }
+
+            std::rename(temporary_path.c_str(), path.c_str());
+        }
+    };
+}
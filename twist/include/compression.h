@@ -0,0 +1,330 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <iostream>
+#include <functional>
+#include <cstdint>
+
+#include <zlib.h>
+
+#if defined(COMPRESSION_HAS_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "output.h"
+#include "pipeline.h"
+
+/*
+    Compressed output. What the serializer hands over is cut into blocks of about a
+    megabyte that a pool of workers compresses independently, each into a complete
+    gzip member or zstd frame, and the results are written in order. Concatenated
+    members (frames) are themselves a valid gzip (zstd) stream, so the file reads back
+    with gzip -d or zstd -d while compressing takes as many cores as it is given.
+    zstd is only there when the build found its headers and library.
+*/
+namespace Compression
+{
+    //
+    // [SECTION] Types
+    //
+
+    enum class Format
+    {
+        NONE,
+        GZIP,
+        ZSTD,
+    };
+
+    struct Settings
+    {
+        Format format{Format::NONE};
+        /* -1 for the format's default */
+        int level{-1};
+        size_t worker_count{1};
+    };
+
+    //
+    // [SECTION] Functions
+    //
+
+    inline bool isAvailable(Format format)
+    {
+#if defined(COMPRESSION_HAS_ZSTD)
+        return true;
+#else
+        return format != Format::ZSTD;
+#endif
+    }
+
+    /* What the format appends to file names */
+    inline const char *extension(Format format)
+    {
+        switch (format)
+        {
+        case Format::GZIP:
+            return ".gz";
+        case Format::ZSTD:
+            return ".zst";
+        default:
+            return "";
+        }
+    }
+
+    /* Reads a --compress name and level into settings, false with a message on stderr when they do not fit */
+    inline bool parse(const std::string &name, int level, Settings &settings)
+    {
+        if (name == "gzip")
+            settings.format = Format::GZIP;
+        else if (name == "zstd")
+            settings.format = Format::ZSTD;
+        else
+        {
+            std::cerr << "[x] Unknown compression \"" << name << "\", expected gzip or zstd" << std::endl;
+            return false;
+        }
+
+        if (!isAvailable(settings.format))
+        {
+            std::cerr << "[x] This build has no " << name << " support" << std::endl;
+            return false;
+        }
+
+        int maximum_level{settings.format == Format::GZIP ? 9 : 22};
+        if (level != -1 && (level < 1 || level > maximum_level))
+        {
+            std::cerr << "[x] " << name << " levels go from 1 to " << maximum_level << std::endl;
+            return false;
+        }
+
+        settings.level = level;
+        return true;
+    }
+
+    /* One complete gzip member, empty when zlib fails */
+    inline std::string gzipMember(const std::string &input, int level)
+    {
+        /* One deflate state per worker thread, reset between blocks instead of reallocated */
+        struct Deflater
+        {
+            z_stream stream{};
+            int level{};
+            bool is_open{false};
+
+            ~Deflater()
+            {
+                if (is_open)
+                    deflateEnd(&stream);
+            }
+        };
+
+        thread_local Deflater deflater;
+        int wanted_level{level == -1 ? Z_DEFAULT_COMPRESSION : level};
+
+        if (deflater.is_open && deflater.level != wanted_level)
+        {
+            deflateEnd(&deflater.stream);
+            deflater.is_open = false;
+        }
+
+        if (!deflater.is_open)
+        {
+            deflater.stream = {};
+            /* 15 bits of window, +16 for a gzip header and trailer instead of zlib's */
+            if (deflateInit2(&deflater.stream, wanted_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return {};
+            deflater.level = wanted_level;
+            deflater.is_open = true;
+        }
+        else if (deflateReset(&deflater.stream) != Z_OK)
+            return {};
+
+        z_stream &stream{deflater.stream};
+        std::string output(deflateBound(&stream, static_cast<uLong>(input.size())), '\0');
+
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        stream.next_out = reinterpret_cast<Bytef *>(&output[0]);
+        stream.avail_out = static_cast<uInt>(output.size());
+
+        if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+            return {};
+
+        output.resize(stream.total_out);
+        return output;
+    }
+
+#if defined(COMPRESSION_HAS_ZSTD)
+    /* One complete zstd frame, empty when zstd fails */
+    inline std::string zstdFrame(const std::string &input, int level)
+    {
+        struct Context
+        {
+            ZSTD_CCtx *p_context{ZSTD_createCCtx()};
+
+            ~Context()
+            {
+                ZSTD_freeCCtx(p_context);
+            }
+        };
+
+        thread_local Context context;
+        if (context.p_context == nullptr)
+            return {};
+
+        std::string output(ZSTD_compressBound(input.size()), '\0');
+        size_t size{ZSTD_compressCCtx(context.p_context, &output[0], output.size(), input.data(), input.size(), level == -1 ? ZSTD_CLEVEL_DEFAULT : level)};
+        if (ZSTD_isError(size))
+            return {};
+
+        output.resize(size);
+        return output;
+    }
+#endif
+
+    /* Compresses input on its own, so the result can be concatenated with other blocks */
+    inline std::string compressBlock(Format format, int level, const std::string &input)
+    {
+        switch (format)
+        {
+        case Format::GZIP:
+            return gzipMember(input, level);
+#if defined(COMPRESSION_HAS_ZSTD)
+        case Format::ZSTD:
+            return zstdFrame(input, level);
+#endif
+        default:
+            return input;
+        }
+    }
+
+    //
+    // [SECTION] Stream
+    //
+
+    /*
+        Compresses everything written to it into target, or passes it through untouched
+        when settings.format is NONE. close() must be called before target is closed.
+    */
+    class Stream : public Output::Sink
+    {
+    public:
+        static constexpr size_t BLOCK_BYTES{1 << 20};
+
+        Stream(Output::Sink &target, const Settings &settings) : target(target), format(settings.format)
+        {
+            if (format == Format::NONE)
+                return;
+
+            size_t worker_count{std::max<size_t>(1, settings.worker_count)};
+            int level{settings.level};
+
+            p_pipeline = std::make_unique<Pipeline::Ordered<std::string>>(
+                worker_count, worker_count * 4,
+                [this, level](std::string &block)
+                {
+                    std::string compressed{compressBlock(format, level, block)};
+                    if (compressed.empty())
+                        has_failed = true;
+                    return compressed;
+                },
+                [this](std::string &compressed)
+                { this->target.write(compressed); },
+                [] {});
+
+            block.reserve(BLOCK_BYTES);
+        }
+
+        ~Stream()
+        {
+            close();
+        }
+
+        void write(std::string &buffer) override
+        {
+            if (!p_pipeline)
+            {
+                target.write(buffer);
+                return;
+            }
+
+            taken += buffer.size();
+
+            /* Large buffers become a block as they are, the writer gets the reserved one back */
+            if (block.empty())
+                block.swap(buffer);
+            else
+            {
+                block += buffer;
+                buffer.clear();
+            }
+
+            if (block.size() >= BLOCK_BYTES)
+                submitBlock();
+        }
+
+        void whenWritten(std::function<void()> callback) override
+        {
+            if (!p_pipeline)
+            {
+                target.whenWritten(std::move(callback));
+                return;
+            }
+
+            submitBlock();
+            p_pipeline->mark([this, callback]
+                           { target.whenWritten(callback); });
+        }
+
+        /* Uncompressed bytes taken, the file's own size when passing through */
+        uint64_t size() const override
+        {
+            return format != Format::NONE ? taken : target.size();
+        }
+
+        /* Only passing through, compressed blocks cannot be cut back */
+        bool truncate(uint64_t size) override
+        {
+            return format == Format::NONE && target.truncate(size);
+        }
+
+        /* Compresses what is left and hands every block to target, false when a block failed */
+        bool close()
+        {
+            if (!p_pipeline)
+                return true;
+
+            /* Even an empty stream is one member (frame), an empty file would not decompress */
+            if (!block.empty() || !has_submitted)
+                submitBlock(true);
+            p_pipeline->finish();
+            p_pipeline.reset();
+
+            if (has_failed)
+                std::cerr << "[x] Failed to compress a block of output" << std::endl;
+            return !has_failed;
+        }
+
+    private:
+        Output::Sink &target;
+        Format format;
+        std::unique_ptr<Pipeline::Ordered<std::string>> p_pipeline;
+        std::string block;
+        uint64_t taken{};
+        bool has_submitted{false};
+        std::atomic<bool> has_failed{false};
+
+        void submitBlock(bool is_forced = false)
+        {
+            if (block.empty() && !is_forced)
+                return;
+
+            p_pipeline->submit(std::move(block));
+            has_submitted = true;
+            block = std::string();
+            block.reserve(BLOCK_BYTES);
+        }
+    };
+}
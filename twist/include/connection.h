@@ -0,0 +1,166 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+
+#include <ldap.h>
+
+namespace Connection
+{
+    //
+    // [SECTION] Types
+    //
+
+    struct Settings
+    {
+        std::string uri;
+        std::string bind_dn;
+        std::string password;
+        bool is_ldaps;
+        bool is_start_tls;
+    };
+
+    //
+    // [SECTION] Functions
+    //
+
+    /* Returns a bound session or nullptr (errors are reported on stderr) */
+    inline LDAP *open(const Settings &settings)
+    {
+        LDAP *p_ldap{};
+        int return_code{ldap_initialize(&p_ldap, settings.uri.c_str())};
+
+        if (return_code != LDAP_SUCCESS)
+        {
+            std::cerr << "[x] Failed to initialize LDAP: " << ldap_err2string(return_code) << std::endl;
+            return nullptr;
+        }
+
+        int version = LDAP_VERSION3;
+
+        return_code = ldap_set_option(p_ldap, LDAP_OPT_PROTOCOL_VERSION, &version);
+        if (return_code != LDAP_OPT_SUCCESS)
+        {
+            std::cerr << "[x] Failed to set LDAP version: " << ldap_err2string(return_code) << std::endl;
+            ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
+            return nullptr;
+        }
+
+        return_code = ldap_set_option(p_ldap, LDAP_OPT_REFERRALS, LDAP_OPT_OFF);
+        if (return_code != LDAP_OPT_SUCCESS)
+            std::cout << "[!] Could not disable referrals" << std::endl;
+
+        struct timeval timeout;
+        timeout.tv_sec = 30;
+        timeout.tv_usec = 0;
+        return_code = ldap_set_option(p_ldap, LDAP_OPT_NETWORK_TIMEOUT, &timeout);
+        if (return_code != LDAP_OPT_SUCCESS)
+            std::cout << "[!] Could not set network timeout" << std::endl;
+
+        if (settings.is_ldaps || settings.is_start_tls)
+        {
+            int tls_req = LDAP_OPT_X_TLS_NEVER;
+            ldap_set_option(p_ldap, LDAP_OPT_X_TLS_REQUIRE_CERT, &tls_req);
+
+            int tls_protocol = LDAP_OPT_X_TLS_PROTOCOL_TLS1_2;
+            ldap_set_option(p_ldap, LDAP_OPT_X_TLS_PROTOCOL_MIN, &tls_protocol);
+        }
+
+        if (settings.is_start_tls)
+        {
+            return_code = ldap_start_tls_s(p_ldap, nullptr, nullptr);
+            if (return_code != LDAP_SUCCESS)
+            {
+                std::cerr << "[x] Failed to start TLS: " << ldap_err2string(return_code) << std::endl;
+                ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
+                return nullptr;
+            }
+        }
+
+        return_code = ldap_simple_bind_s(p_ldap, settings.bind_dn.c_str(), settings.password.c_str());
+
+        if (return_code != LDAP_SUCCESS)
+        {
+            std::cerr << "[x] Failed to bind LDAP: " << ldap_err2string(return_code) << std::endl;
+            ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
+            return nullptr;
+        }
+
+        return p_ldap;
+    }
+
+    /* Fixed set of bound sessions handed out to one thread at a time, at most limit() of them at once */
+    class Pool
+    {
+    public:
+        ~Pool()
+        {
+            for (LDAP *p_ldap : sessions)
+                ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
+        }
+
+        bool open(const Settings &settings, int count)
+        {
+            for (int i{}; i < count; i++)
+            {
+                LDAP *p_ldap{Connection::open(settings)};
+                if (p_ldap == nullptr)
+                    return false;
+
+                sessions.push_back(p_ldap);
+                idle.push_back(p_ldap);
+            }
+
+            max_in_use = sessions.size();
+            return true;
+        }
+
+        size_t size() const
+        {
+            return sessions.size();
+        }
+
+        LDAP *acquire()
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            available.wait(lock, [this]
+                           { return !idle.empty() && sessions.size() - idle.size() < max_in_use; });
+
+            LDAP *p_ldap{idle.back()};
+            idle.pop_back();
+            return p_ldap;
+        }
+
+        /* Sessions already handed out are kept, only further acquire() calls wait */
+        void limit(size_t count)
+        {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                max_in_use = std::max<size_t>(1, count);
+            }
+
+            available.notify_all();
+        }
+
+        void release(LDAP *p_ldap)
+        {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                idle.push_back(p_ldap);
+            }
+
+            available.notify_one();
+        }
+
+    private:
+        std::vector<LDAP *> sessions;
+        std::vector<LDAP *> idle;
+        size_t max_in_use{};
+        std::mutex mutex;
+        std::condition_variable available;
+    };
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <ldap.h>
+
+#include "object-search.h"
+#include "sid-table.h"
+#include "json.h"
+
+namespace DescriptorCache
+{
+    //
+    // [SECTION] Functions
+    //
+
+    /* Word-at-a-time multiply/xorshift hash, good enough to spread raw descriptor blobs */
+    inline uint64_t hashBytes(const char *data, size_t size)
+    {
+        const uint64_t MULTIPLIER{0x9E3779B97F4A7C15ULL};
+        uint64_t hash{size * MULTIPLIER};
+
+        size_t i{};
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * MULTIPLIER;
+            hash ^= hash >> 29;
+        }
+
+        uint64_t tail{};
+        memcpy(&tail, data + i, size - i);
+        hash = (hash ^ tail) * MULTIPLIER;
+        hash ^= hash >> 32;
+
+        return hash;
+    }
+
+    //
+    // [SECTION] Types
+    //
+
+    struct BlobHash
+    {
+        size_t operator()(const std::string &blob) const
+        {
+            return static_cast<size_t>(hashBytes(blob.data(), blob.size()));
+        }
+    };
+
+    /*
+        Decodes each distinct nTSecurityDescriptor once. Without a table descriptors are
+        still written inline, from a cached rendering (bounded by max_rendered_bytes).
+        With a table every object only references an id and writeTable() emits each
+        distinct descriptor once.
+    */
+    class Cache
+    {
+    public:
+        Cache(bool use_table, SidTable::Interner *p_sid_table = nullptr, size_t max_rendered_bytes = 256 << 20)
+            : use_table(use_table), p_sid_table(p_sid_table), max_rendered_bytes(max_rendered_bytes) {}
+
+        bool usesTable() const
+        {
+            return use_table;
+        }
+
+        /* Rendering of the descriptor as a value at the given writer depth */
+        std::string render(const struct berval *value, int depth)
+        {
+            std::string key(value->bv_val, value->bv_len);
+            key += static_cast<char>(depth);
+
+            Shard &shard{shardFor(key)};
+            {
+                std::lock_guard<std::mutex> lock{shard.mutex};
+                auto it{shard.slots.find(key)};
+                if (it != shard.slots.end())
+                {
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return it->second.rendered;
+                }
+            }
+
+            misses.fetch_add(1, std::memory_order_relaxed);
+
+            JSON::Writer writer{nullptr, depth};
+            ObjectSearch::writeSecurityDescriptor(value, p_sid_table, writer);
+            std::string rendered{writer.take()};
+
+            if (rendered_bytes.fetch_add(rendered.size() + key.size(), std::memory_order_relaxed) < max_rendered_bytes)
+            {
+                std::lock_guard<std::mutex> lock{shard.mutex};
+                shard.slots.emplace(std::move(key), Slot{-1, rendered});
+            }
+
+            return rendered;
+        }
+
+        /* Id of the descriptor in the table, adding it on first sight */
+        int reference(const struct berval *value)
+        {
+            std::string key(value->bv_val, value->bv_len);
+
+            Shard &shard{shardFor(key)};
+            std::lock_guard<std::mutex> lock{shard.mutex};
+
+            auto it{shard.slots.find(key)};
+            if (it != shard.slots.end())
+            {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return it->second.id;
+            }
+
+            misses.fetch_add(1, std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> table_lock{table_mutex};
+            int id{static_cast<int>(table.size())};
+            auto inserted{shard.slots.emplace(std::move(key), Slot{id, {}})};
+            table.push_back(&inserted.first->first);
+            return id;
+        }
+
+        /* Writes every referenced descriptor as an array indexed by id */
+        void writeTable(JSON::Writer &writer)
+        {
+            std::lock_guard<std::mutex> table_lock{table_mutex};
+
+            writer.beginArray();
+
+            for (const std::string *p_blob : table)
+            {
+                berval blob;
+                blob.bv_val = const_cast<char *>(p_blob->data());
+                blob.bv_len = p_blob->size();
+                ObjectSearch::writeSecurityDescriptor(&blob, p_sid_table, writer);
+            }
+
+            writer.endArray();
+        }
+
+        uint64_t hitCount() const
+        {
+            return hits.load(std::memory_order_relaxed);
+        }
+
+        uint64_t missCount() const
+        {
+            return misses.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Slot
+        {
+            int id;
+            std::string rendered;
+        };
+
+        struct Shard
+        {
+            std::mutex mutex;
+            std::unordered_map<std::string, Slot, BlobHash> slots;
+        };
+
+        bool use_table;
+        SidTable::Interner *p_sid_table;
+        size_t max_rendered_bytes;
+        std::atomic<size_t> rendered_bytes{0};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::array<Shard, 64> shards;
+        std::mutex table_mutex;
+        std::deque<const std::string *> table;
+
+        Shard &shardFor(const std::string &key)
+        {
+            /* The low bits pick the bucket inside the shard, use the high ones for the shard */
+            return shards[hashBytes(key.data(), key.size()) >> 58];
+        }
+    };
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+
+#include <strings.h>
+
+#include <ldap.h>
+
+#include "object-search.h"
+#include "connection.h"
+#include "adaptive.h"
+#include "schemas.h"
+#include "dump.h"
+#include "output.h"
+#include "compression.h"
+#include "json.h"
+
+/*
+    Second phase of a two-phase dump: output.json was written without security
+    descriptors, which are then searched for class by class, the objects worth looking
+    at first (the domain, protected groups, GPOs and OUs linking them) ahead of the
+    rest. Every descriptor is appended to an array in its own file as its page comes
+    in, so what arrived is on disk while the remainder is still being fetched.
+*/
+namespace DescriptorPass
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* Descriptors of one slice of a class, lower priorities are fetched first */
+    struct Task
+    {
+        const ObjectSearch::Entry *p_entry;
+        const char *attribute;
+        std::string filter;
+        int priority;
+    };
+
+    //
+    // [SECTION] Functions
+    //
+
+    /* Splits every class holding a descriptor into slices, ordered by how soon they are wanted */
+    inline std::vector<Task> plan(const ObjectSearch::List &searches)
+    {
+        std::vector<Task> tasks;
+
+        for (const auto &entry : searches)
+        {
+            auto descriptor{std::find_if(entry.attributes.begin(), entry.attributes.end(), [](const ObjectSearch::Attribute &attribute)
+                                         { return attribute.type == ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR; })};
+            if (descriptor == entry.attributes.end())
+                continue;
+
+            std::string object_class{entry.objectClass};
+            std::string class_filter{"(objectClass=" + object_class + ")"};
+            auto split{[&](const std::string &condition, int high_priority, int low_priority)
+                       {
+                           tasks.push_back({&entry, descriptor->name, "(&" + class_filter + condition + ")", high_priority});
+                           tasks.push_back({&entry, descriptor->name, "(&" + class_filter + "(!" + condition + "))", low_priority});
+                       }};
+
+            /* adminCount marks the groups and accounts AdminSDHolder protects */
+            if (object_class == "domainDNS" || object_class == "groupPolicyContainer")
+                tasks.push_back({&entry, descriptor->name, class_filter, 0});
+            else if (object_class == "group")
+                split("(adminCount=1)", 0, 2);
+            else if (object_class == "organizationalUnit")
+                split("(gPLink=*)", 0, 2);
+            else if (object_class == "user")
+                split("(adminCount=1)", 1, 2);
+            else
+                tasks.push_back({&entry, descriptor->name, class_filter, 2});
+        }
+
+        std::stable_sort(tasks.begin(), tasks.end(), [](const Task &left, const Task &right)
+                         { return left.priority < right.priority; });
+        return tasks;
+    }
+
+    /* Renders {"class", "distinguishedName", <attribute>} for one entry, nothing when it holds no descriptor */
+    inline std::string renderEntry(LDAP *p_ldap, LDAPMessage *message, const Task &task, const Dump::Options &options, int depth)
+    {
+        BerElement *p_ber{};
+        berval dn{};
+        std::string rendered;
+
+        if (ldap_get_dn_ber(p_ldap, message, &p_ber, &dn) != LDAP_SUCCESS)
+        {
+            if (p_ber != nullptr)
+                ber_free(p_ber, 0);
+            return rendered;
+        }
+
+        Schemas::Slot slot{};
+        Dump::forEachAttribute(p_ber, [&slot, &task](const berval &name, BerVarray values, size_t count)
+                               {
+            if (slot.values == nullptr && strncasecmp(name.bv_val, task.attribute, name.bv_len) == 0 && task.attribute[name.bv_len] == '\0')
+                slot = {values, count, 0};
+            else if (values != nullptr)
+                ber_memfree(values); });
+
+        if (slot.values != nullptr && slot.count > 0)
+        {
+            JSON::Writer writer{nullptr, depth};
+            writer.beginObject();
+            writer.key("class");
+            writer.value(task.p_entry->name);
+            writer.key("distinguishedName");
+            writer.value(dn.bv_val, dn.bv_len);
+            writer.key(task.attribute);
+            Schemas::writeValue<ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR>(slot, options, writer);
+            writer.endObject();
+            rendered = writer.take();
+        }
+
+        if (slot.values != nullptr)
+            ber_memfree(slot.values);
+        ber_free(p_ber, 0);
+
+        return rendered;
+    }
+
+    /*
+        Fetches the descriptors of searches into a JSON array at path, slices handed out in
+        priority order to the sessions of pool. Returns false when a search failed, what
+        was fetched until then stays in the file (the array is closed either way).
+    */
+    inline bool run(Connection::Pool &pool, const std::string &base_dn, const ObjectSearch::List &searches, const Dump::Options &options, const std::string &path,
+                    const Compression::Settings &compression = {})
+    {
+        Output::File output;
+        if (!output.open(path))
+        {
+            std::cerr << "[x] Failed to open " << path << std::endl;
+            return false;
+        }
+
+        std::vector<Task> tasks{plan(searches)};
+        std::vector<size_t> counts(tasks.size(), 0);
+        std::vector<int> results(tasks.size(), 0);
+        std::atomic<size_t> next_task{0};
+        std::mutex output_mutex;
+
+        Compression::Stream stream{output, compression};
+        JSON::Writer writer{&stream};
+        writer.beginArray();
+        int entry_depth{writer.depth()};
+
+        std::vector<std::thread> workers;
+        for (size_t i{}; i < std::min(pool.size(), tasks.size()); i++)
+        {
+            workers.emplace_back([&]
+                                 {
+                for (size_t task_index{next_task++}; task_index < tasks.size(); task_index = next_task++)
+                {
+                    const Task &task{tasks[task_index]};
+                    Dump::Query query{task.p_entry->name, task.filter, {task.attribute, nullptr}, false};
+                    std::vector<std::string> page;
+
+                    LDAP *p_ldap{pool.acquire()};
+                    results[task_index] = Dump::searchPages(
+                        p_ldap, base_dn, query, *options.p_controller, nullptr,
+                        [&](LDAPMessage *message)
+                        {
+                            std::string rendered{renderEntry(p_ldap, message, task, options, entry_depth)};
+                            if (!rendered.empty())
+                                page.push_back(std::move(rendered));
+                            ldap_msgfree(message);
+                        },
+                        [&](const berval *)
+                        {
+                            std::lock_guard<std::mutex> lock{output_mutex};
+                            for (const std::string &rendered : page)
+                                writer.raw(rendered.data(), rendered.size());
+                            writer.flush();
+
+                            counts[task_index] += page.size();
+                            page.clear();
+                        });
+                    pool.release(p_ldap);
+                } });
+        }
+
+        for (auto &worker : workers)
+            worker.join();
+
+        writer.endArray();
+        writer.flush();
+
+        bool is_complete{stream.close()};
+        is_complete = output.close() && is_complete;
+        if (options.p_stats != nullptr)
+            options.p_stats->onWrite(output.writtenBytes(), output.writeTime());
+
+        for (size_t i{}; i < tasks.size(); i++)
+        {
+            std::cout << "[*] Descriptors of " << tasks[i].p_entry->name << " " << tasks[i].filter << ": " << counts[i] << std::endl;
+            is_complete = is_complete && results[i] == 0;
+        }
+
+        return is_complete;
+    }
+}
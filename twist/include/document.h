@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "json.h"
+
+/*
+    In-memory JSON documents for what has to be built before it is written (security
+    descriptors, post-processing). Nodes, keys and strings are bumped out of an arena
+    owned by the document and released all at once by clear() or the destructor, so
+    building one costs no allocation once the arena has grown to size. Objects keep
+    their members in insertion order in a flat array, integers are 64-bit signed or
+    unsigned.
+
+    Values are small handles: build a child first, then add it to its parent. A
+    reference returned by set() or push() stays valid until its container grows.
+*/
+namespace Document
+{
+    //
+    // [SECTION] Arena
+    //
+
+    /* Bump allocator whose blocks are only given back by the destructor, reset() reuses them */
+    class Arena
+    {
+    public:
+        explicit Arena(size_t block_size = 1 << 16) : block_size(block_size) {}
+
+        ~Arena()
+        {
+            for (const Block &block : blocks)
+                std::free(block.p_data);
+        }
+
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        void *allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+        {
+            size_t offset{(used + alignment - 1) & ~(alignment - 1)};
+
+            if (current >= blocks.size() || offset + size > blocks[current].size)
+            {
+                nextBlock(size + alignment);
+                offset = 0;
+            }
+
+            used = offset + size;
+            return blocks[current].p_data + offset;
+        }
+
+        template <typename T>
+        T *allocateArray(size_t count)
+        {
+            return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        /* Forgets everything allocated, the blocks are kept for what comes next */
+        void reset()
+        {
+            current = 0;
+            used = 0;
+        }
+
+        size_t blockCount() const
+        {
+            return blocks.size();
+        }
+
+    private:
+        struct Block
+        {
+            char *p_data;
+            size_t size;
+        };
+
+        size_t block_size;
+        std::vector<Block> blocks;
+        size_t current{};
+        size_t used{};
+
+        /* Moves to the next kept block when it is large enough, to a new one otherwise */
+        void nextBlock(size_t minimum)
+        {
+            size_t next{blocks.empty() ? 0 : current + 1};
+            used = 0;
+
+            if (next < blocks.size() && blocks[next].size >= minimum)
+            {
+                current = next;
+                return;
+            }
+
+            size_t size{std::max(block_size, minimum)};
+            char *p_data{static_cast<char *>(std::malloc(size))};
+            if (p_data == nullptr)
+                throw std::bad_alloc{};
+
+            blocks.insert(blocks.begin() + static_cast<std::ptrdiff_t>(std::min(next, blocks.size())), Block{p_data, size});
+            current = std::min(next, blocks.size() - 1);
+        }
+    };
+
+    //
+    // [SECTION] Types
+    //
+
+    enum class Type : uint8_t
+    {
+        NULL_VALUE,
+        BOOLEAN,
+        INTEGER,
+        UNSIGNED,
+        STRING,
+        /* Already serialized at the depth it will be written at */
+        RAW,
+        ARRAY,
+        OBJECT,
+    };
+
+    struct Member;
+
+    struct Value
+    {
+        Type type{Type::NULL_VALUE};
+        union
+        {
+            bool boolean;
+            int64_t integer;
+            uint64_t unsigned_integer;
+            struct
+            {
+                const char *data;
+                size_t size;
+            } string;
+            /* Array items are Values, object members are Members */
+            struct
+            {
+                void *items;
+                uint32_t size;
+                uint32_t capacity;
+            } container;
+        };
+
+        Value() : unsigned_integer(0) {}
+
+        std::string_view text() const
+        {
+            return {string.data, string.size};
+        }
+
+        size_t size() const
+        {
+            return container.size;
+        }
+
+        const Value *items() const
+        {
+            return static_cast<const Value *>(container.items);
+        }
+
+        const Member *members() const
+        {
+            return static_cast<const Member *>(container.items);
+        }
+    };
+
+    struct Member
+    {
+        std::string_view key;
+        Value value;
+    };
+
+    //
+    // [SECTION] Document
+    //
+
+    class Document
+    {
+    public:
+        explicit Document(size_t block_size = 1 << 16) : arena(block_size) {}
+
+        static Value boolean(bool boolean)
+        {
+            Value value;
+            value.type = Type::BOOLEAN;
+            value.boolean = boolean;
+            return value;
+        }
+
+        static Value integer(int64_t integer)
+        {
+            Value value;
+            value.type = Type::INTEGER;
+            value.integer = integer;
+            return value;
+        }
+
+        static Value unsignedInteger(uint64_t unsigned_integer)
+        {
+            Value value;
+            value.type = Type::UNSIGNED;
+            value.unsigned_integer = unsigned_integer;
+            return value;
+        }
+
+        static Value array()
+        {
+            return container(Type::ARRAY);
+        }
+
+        static Value object()
+        {
+            return container(Type::OBJECT);
+        }
+
+        /* Copies text into the document */
+        Value string(std::string_view text)
+        {
+            Value value;
+            value.type = Type::STRING;
+            value.string = {copy(text), text.size()};
+            return value;
+        }
+
+        Value raw(std::string_view serialized)
+        {
+            Value value{string(serialized)};
+            value.type = Type::RAW;
+            return value;
+        }
+
+        /* Appends a member to object, key is copied and not checked for duplicates */
+        Value &set(Value &object, std::string_view key, const Value &value)
+        {
+            Member *p_member{&append<Member>(object)};
+            p_member->key = {copy(key), key.size()};
+            p_member->value = value;
+            return p_member->value;
+        }
+
+        Value &push(Value &array, const Value &value)
+        {
+            Value *p_item{&append<Value>(array)};
+            *p_item = value;
+            return *p_item;
+        }
+
+        /* First member of object called key, nullptr when there is none */
+        static const Value *find(const Value &object, std::string_view key)
+        {
+            for (size_t i{}; i < object.size(); i++)
+                if (object.members()[i].key == key)
+                    return &object.members()[i].value;
+            return nullptr;
+        }
+
+        /* Releases every value of the document at once */
+        void clear()
+        {
+            arena.reset();
+        }
+
+        const Arena &allocator() const
+        {
+            return arena;
+        }
+
+        static void write(const Value &value, JSON::Writer &writer)
+        {
+            switch (value.type)
+            {
+            case Type::NULL_VALUE:
+                writer.raw("null", 4);
+                break;
+            case Type::BOOLEAN:
+                writer.value(value.boolean);
+                break;
+            case Type::INTEGER:
+                writer.value(value.integer);
+                break;
+            case Type::UNSIGNED:
+                writer.value(value.unsigned_integer);
+                break;
+            case Type::STRING:
+                writer.value(value.string.data, value.string.size);
+                break;
+            case Type::RAW:
+                writer.raw(value.string.data, value.string.size);
+                break;
+            case Type::ARRAY:
+                writer.beginArray();
+                for (size_t i{}; i < value.size(); i++)
+                    write(value.items()[i], writer);
+                writer.endArray();
+                break;
+            case Type::OBJECT:
+                writer.beginObject();
+                for (size_t i{}; i < value.size(); i++)
+                {
+                    const Member &member{value.members()[i]};
+                    writer.key(member.key.data(), member.key.size());
+                    write(member.value, writer);
+                }
+                writer.endObject();
+                break;
+            }
+        }
+
+        static std::string toString(const Value &value, int indent_level = 0)
+        {
+            JSON::Writer writer{nullptr, indent_level};
+            write(value, writer);
+            return writer.take();
+        }
+
+    private:
+        Arena arena;
+
+        static Value container(Type type)
+        {
+            Value value;
+            value.type = type;
+            value.container = {nullptr, 0, 0};
+            return value;
+        }
+
+        const char *copy(std::string_view text)
+        {
+            if (text.empty())
+                return "";
+
+            char *p_copy{arena.allocateArray<char>(text.size())};
+            memcpy(p_copy, text.data(), text.size());
+            return p_copy;
+        }
+
+        /* Room for one more item at the end of container, doubling it (in the arena) when full */
+        template <typename Item>
+        Item &append(Value &container)
+        {
+            auto &items{container.container};
+
+            if (items.size == items.capacity)
+            {
+                uint32_t capacity{items.capacity == 0 ? 4 : items.capacity * 2};
+                Item *p_items{arena.allocateArray<Item>(capacity)};
+                if (items.size != 0)
+                    memcpy(static_cast<void *>(p_items), items.items, sizeof(Item) * items.size);
+                items.items = p_items;
+                items.capacity = capacity;
+            }
+
+            return static_cast<Item *>(items.items)[items.size++];
+        }
+    };
+}
@@ -0,0 +1,582 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <iostream>
+#include <cstring>
+
+#include <ldap.h>
+
+#include "object-search.h"
+#include "descriptor-cache.h"
+#include "sid-table.h"
+#include "pipeline.h"
+#include "capture.h"
+#include "checkpoint.h"
+#include "adaptive.h"
+#include "ranges.h"
+#include "stats.h"
+#include "json.h"
+
+namespace Dump
+{
+    //
+    // [SECTION] Types
+    //
+
+    struct Options
+    {
+        /* Decode threads per search, 0 decodes on the fetching thread */
+        size_t decode_workers;
+        DescriptorCache::Cache *p_descriptor_cache;
+        /* When set SIDs are written as indices into this table */
+        SidTable::Interner *p_sid_table;
+        /* When set every received entry is also appended to a capture file */
+        Capture::Recorder *p_recorder;
+        /* When set every class checkpoints its pages there and resumes from it */
+        Checkpoint::Journal *p_journal;
+        /* Page size and concurrency of live searches */
+        Adaptive::Controller *p_controller;
+        /* When set values AD sent only the first range of are fetched in full, otherwise that range is written */
+        Ranges::Fetcher *p_ranges;
+        /* When set decoding is timed per attribute type and per entry */
+        Stats::Collector *p_stats;
+    };
+
+    //
+    // [SECTION] Functions
+    //
+
+    inline LDAPControl *createSDFlagsControl()
+    {
+        BerElement *ber{ber_alloc_t(LBER_USE_DER)};
+        if (!ber)
+            return nullptr;
+
+        if (ber_printf(ber, "{i}", 7) == -1)
+        {
+            ber_free(ber, 1);
+            return nullptr;
+        }
+
+        berval *encodedValue{};
+        if (ber_flatten(ber, &encodedValue) == -1)
+        {
+            ber_free(ber, 1);
+            return nullptr;
+        }
+
+        LDAPControl *control{new LDAPControl};
+        control->ldctl_oid = const_cast<char *>("1.2.840.113556.1.4.801");
+        control->ldctl_iscritical = 0;
+        control->ldctl_value.bv_len = encodedValue->bv_len;
+        control->ldctl_value.bv_val = new char[encodedValue->bv_len];
+        memcpy(control->ldctl_value.bv_val, encodedValue->bv_val, encodedValue->bv_len);
+
+        ber_bvfree(encodedValue);
+        ber_free(ber, 1);
+        return control;
+    }
+
+    /*
+        Walks the attribute list of an entry exactly once, p_ber must be positioned on it
+        (as left by ldap_get_dn_ber). Values are parsed in place and never copied, visit
+        receives (name, values, count) and owns values (free with ber_memfree).
+    */
+    template <typename Visitor>
+    bool forEachAttribute(BerElement *p_ber, Visitor &&visit)
+    {
+        ber_len_t length{};
+
+        while (ber_peek_tag(p_ber, &length) != LBER_DEFAULT)
+        {
+            berval name{};
+            BerVarray values{};
+            ber_len_t count{sizeof(BerValue)};
+
+            if (ber_scanf(p_ber, "{mM}", &name, &values, &count, static_cast<ber_len_t>(0)) == LBER_ERROR)
+                return false;
+
+            visit(name, values, static_cast<size_t>(count));
+        }
+
+        return true;
+    }
+
+    /* Writes one search result entry as a JSON object, false when it could not be written whole */
+    inline bool writeEntry(LDAP *p_ldap, LDAPMessage *message_entry, const ObjectSearch::Entry &entry, const Options &options, JSON::Writer &writer)
+    {
+        BerElement *p_ber{};
+        berval dn{};
+
+        if (ldap_get_dn_ber(p_ldap, message_entry, &p_ber, &dn) != LDAP_SUCCESS)
+        {
+            std::cerr << "[!] Could not read an entry of \"" << entry.name << "\"" << std::endl;
+            if (p_ber != nullptr)
+                ber_free(p_ber, 0);
+            return false;
+        }
+
+        Stats::Timer timer{options.p_stats, Stats::ENTRY_SLOT};
+        bool is_complete{entry.writeEntry(p_ber, dn, entry, options, writer)};
+        if (!is_complete)
+            std::cerr << "[!] Entry \"" << std::string(dn.bv_val, dn.bv_len) << "\" is incomplete" << std::endl;
+
+        ber_free(p_ber, 0);
+        return is_complete;
+    }
+
+    /*
+        Writes one entry from its BER encoded SearchResultEntry protocol op, the same bytes
+        ldap_get_dn_ber starts from. Like libldap, lber decodes in place and NUL-terminates
+        values inside the buffer, so it must be writable with one spare byte past its end.
+    */
+    inline bool writeEncodedEntry(const struct berval &encoded, const ObjectSearch::Entry &entry, const Options &options, JSON::Writer &writer)
+    {
+        BerElement *p_ber{ber_alloc_t(LBER_USE_DER)};
+        if (p_ber == nullptr)
+            return false;
+
+        berval buffer{encoded};
+        ber_init2(p_ber, &buffer, LBER_USE_DER);
+
+        berval dn{};
+        Stats::Timer timer{options.p_stats, Stats::ENTRY_SLOT};
+        bool is_valid{ber_scanf(p_ber, "{m{", &dn) != LBER_ERROR && entry.writeEntry(p_ber, dn, entry, options, writer)};
+
+        ber_free(p_ber, 0);
+        return is_valid;
+    }
+
+    /*
+        Decodes on options.decode_workers threads, each input rendered by decode(input, writer)
+        at the current depth of writer, and appends the renderings to writer in submission order.
+    */
+    template <typename Input, typename Decode>
+    std::unique_ptr<Pipeline::Ordered<Input>> createPipeline(const Options &options, JSON::Writer &writer, Decode decode)
+    {
+        int entry_depth{writer.depth()};
+
+        return std::make_unique<Pipeline::Ordered<Input>>(
+            options.decode_workers, options.decode_workers * 64,
+            [decode, entry_depth](Input &input)
+            {
+                JSON::Writer entry_writer{nullptr, entry_depth};
+                decode(input, entry_writer);
+                return entry_writer.take();
+            },
+            [&writer](std::string &rendered)
+            {
+                /* Entries that could not be read render to nothing */
+                if (!rendered.empty())
+                    writer.raw(rendered.data(), rendered.size());
+            },
+            [&writer]
+            { writer.flush(); });
+    }
+
+    /* One subtree search under the base DN */
+    struct Query
+    {
+        /* Names the search in error messages */
+        const char *name;
+        std::string filter;
+        /* nullptr terminated */
+        std::vector<const char *> attributes;
+        /* When set deleted objects (tombstones) are returned too */
+        bool show_deleted;
+    };
+
+    /* Searches every object of the entry's class for the attributes its schema decodes */
+    inline Query classQuery(const ObjectSearch::Entry &entry)
+    {
+        Query query{entry.name, "(objectClass=" + std::string(entry.objectClass) + ")", {}, false};
+
+        for (const auto &attribute : entry.attributes)
+            query.attributes.push_back(attribute.name);
+        query.attributes.push_back(nullptr);
+
+        return query;
+    }
+
+    /* Sends the search request for the page following cookie (nullptr for the first page) */
+    inline int requestPage(LDAP *p_ldap, const std::string &base_dn, const Query &query, int page_size, struct berval *cookie, int &message_id)
+    {
+        LDAPControl *sdControl = createSDFlagsControl();
+        LDAPControl *pageControl = nullptr;
+        struct berval null_cookie = {0, nullptr};
+        struct berval *current_cookie = cookie ? cookie : &null_cookie;
+
+        LDAPControl showDeletedControl{};
+        showDeletedControl.ldctl_oid = const_cast<char *>("1.2.840.113556.1.4.417");
+
+        int rc = ldap_create_page_control(p_ldap, page_size, current_cookie, 0, &pageControl);
+        if (rc == LDAP_SUCCESS)
+        {
+            LDAPControl *serverControls[] = {sdControl, pageControl, query.show_deleted ? &showDeletedControl : nullptr, nullptr};
+            rc = ldap_search_ext(p_ldap, base_dn.c_str(), LDAP_SCOPE_SUBTREE, query.filter.c_str(), const_cast<char **>(query.attributes.data()), 0, serverControls, nullptr, nullptr, 0, &message_id);
+        }
+        else
+            std::cerr << "[x] Failed to create page control: " << ldap_err2string(rc) << std::endl;
+
+        if (sdControl)
+        {
+            delete[] sdControl->ldctl_value.bv_val;
+            delete sdControl;
+        }
+        if (pageControl)
+        {
+            ldap_control_free(pageControl);
+        }
+
+        return rc;
+    }
+
+    /* Bytes of BER the entry took on the wire, give or take its envelope */
+    inline size_t entrySize(LDAP *p_ldap, LDAPMessage *message)
+    {
+        BerElement *p_ber{};
+        berval dn{};
+        ber_len_t attributes_size{};
+
+        if (ldap_get_dn_ber(p_ldap, message, &p_ber, &dn) == LDAP_SUCCESS)
+            ber_get_option(p_ber, LBER_OPT_BER_REMAINING_BYTES, &attributes_size);
+        if (p_ber != nullptr)
+            ber_free(p_ber, 0);
+
+        return dn.bv_len + attributes_size;
+    }
+
+    /*
+        Runs a paged search from start_cookie (nullptr for the first page) and hands every entry
+        message to on_entry, which owns it from then on. The next page is requested as soon
+        as the previous page's result (and its cookie) comes in, on_page(cookie) runs once
+        that request is in flight, with a nullptr cookie after the last page.
+        Page sizes come from controller, which also hears how long each page took, not counting
+        the time spent in on_entry and on_page (a full pipeline or a slow disk holding them up
+        says nothing about the DC). A page the DC refuses before sending any of its entries is
+        asked again, smaller.
+    */
+    template <typename OnEntry, typename OnPage>
+    int searchPages(LDAP *p_ldap, const std::string &base_dn, const Query &query, Adaptive::Controller &controller, struct berval *start_cookie, OnEntry &&on_entry, OnPage &&on_page)
+    {
+        /* Kept for asking the current page again */
+        std::string page_cookie{start_cookie != nullptr ? std::string(start_cookie->bv_val, start_cookie->bv_len) : std::string{}};
+        int page_size{controller.pageSize()};
+        int message_id{};
+
+        auto requestCurrent{[&]
+                            {
+                                berval cookie{page_cookie.size(), page_cookie.data()};
+                                page_size = controller.pageSize();
+                                return requestPage(p_ldap, base_dn, query, page_size, page_cookie.empty() ? nullptr : &cookie, message_id);
+                            }};
+
+        int rc = requestCurrent();
+        if (rc != LDAP_SUCCESS)
+        {
+            std::cerr << "[x] Search failed for \"" << query.name << "\": " << ldap_err2string(rc) << std::endl;
+            return -1;
+        }
+
+        auto page_start{std::chrono::steady_clock::now()};
+        /* Time of the current page spent here rather than waiting for the DC */
+        std::chrono::steady_clock::duration page_blocked{};
+        size_t page_entries{};
+        size_t page_bytes{};
+        int attempt{};
+        bool is_done{false};
+
+        while (!is_done)
+        {
+            LDAPMessage *message{};
+            rc = ldap_result(p_ldap, message_id, LDAP_MSG_ONE, nullptr, &message);
+
+            if (rc <= 0)
+            {
+                int error_code{LDAP_TIMEOUT};
+                if (rc < 0)
+                    ldap_get_option(p_ldap, LDAP_OPT_RESULT_CODE, &error_code);
+
+                std::cerr << "[x] Search failed for \"" << query.name << "\": " << ldap_err2string(error_code) << std::endl;
+                if (message)
+                    ldap_msgfree(message);
+                return -1;
+            }
+
+            switch (ldap_msgtype(message))
+            {
+            case LDAP_RES_SEARCH_ENTRY:
+            {
+                auto entry_start{std::chrono::steady_clock::now()};
+                page_entries++;
+                page_bytes += entrySize(p_ldap, message);
+                on_entry(message);
+                page_blocked += std::chrono::steady_clock::now() - entry_start;
+            }
+            break;
+
+            case LDAP_RES_SEARCH_RESULT:
+            {
+                int result_code{};
+                LDAPControl **returnedControls = nullptr;
+                struct berval *cookie = nullptr;
+
+                rc = ldap_parse_result(p_ldap, message, &result_code, nullptr, nullptr, nullptr, &returnedControls, 1);
+
+                if (rc == LDAP_SUCCESS && Adaptive::isRefusal(result_code) && page_entries == 0 && controller.onRefusal(++attempt))
+                {
+                    std::cerr << "[!] The server refused a page of \"" << query.name << "\" (" << ldap_err2string(result_code) << "), asking again" << std::endl;
+                    if (returnedControls)
+                        ldap_controls_free(returnedControls);
+
+                    rc = requestCurrent();
+                    if (rc != LDAP_SUCCESS)
+                    {
+                        std::cerr << "[x] Search failed for \"" << query.name << "\": " << ldap_err2string(rc) << std::endl;
+                        return -1;
+                    }
+
+                    page_start = std::chrono::steady_clock::now();
+                    page_blocked = {};
+                    break;
+                }
+
+                if (rc != LDAP_SUCCESS || result_code != LDAP_SUCCESS)
+                {
+                    std::cerr << "[x] Search failed for \"" << query.name << "\": " << ldap_err2string(rc != LDAP_SUCCESS ? rc : result_code) << std::endl;
+                    if (returnedControls)
+                        ldap_controls_free(returnedControls);
+                    return -1;
+                }
+
+                if (returnedControls != nullptr)
+                {
+                    ldap_parse_page_control(p_ldap, returnedControls, nullptr, &cookie);
+                    ldap_controls_free(returnedControls);
+                }
+
+                is_done = cookie == nullptr || cookie->bv_len == 0;
+                controller.onPage(page_size, page_entries, page_bytes, std::chrono::steady_clock::now() - page_start - page_blocked, is_done);
+
+                if (!is_done)
+                {
+                    page_cookie.assign(cookie->bv_val, cookie->bv_len);
+                    rc = requestCurrent();
+                    if (rc != LDAP_SUCCESS)
+                    {
+                        std::cerr << "[x] Search failed for \"" << query.name << "\": " << ldap_err2string(rc) << std::endl;
+                        ber_bvfree(cookie);
+                        return -1;
+                    }
+                }
+
+                page_start = std::chrono::steady_clock::now();
+                page_entries = 0;
+                page_bytes = 0;
+                attempt = 0;
+
+                /* The next page is already on its way, so this is held against it */
+                on_page(is_done ? nullptr : cookie);
+                page_blocked = std::chrono::steady_clock::now() - page_start;
+
+                if (cookie != nullptr)
+                    ber_bvfree(cookie);
+            }
+            break;
+
+            default:
+                /* Referrals are disabled, continuation references are skipped */
+                ldap_msgfree(message);
+                break;
+            }
+        }
+
+        return 0;
+    }
+
+    /*
+        Runs the paged search for one object class and streams every entry into writer.
+        Entries are decoded one message at a time as they arrive.
+        With options.decode_workers > 0 this thread only fetches, decoding happens on a worker
+        pool and a writer thread appends the entries in the order they were received.
+        With options.p_journal each page is checkpointed once it is on disk, and a class
+        the journal holds unfinished continues from its cookie into a writer restored to it.
+        AD only accepts a cookie on the connection that issued it, so when the server rejects
+        it the class is cut back to where its entries begin and searched again from the start.
+        An entry that is incomplete (e.g. ranged values that could not be fetched) fails the
+        class once it is written and stops the checkpoints, so a resume fetches it again.
+    */
+    inline int searchClass(LDAP *p_ldap, const std::string &base_dn, const ObjectSearch::Entry &entry, const Options &options, JSON::Writer &writer)
+    {
+        Checkpoint::Progress progress{};
+        bool is_resuming{options.p_journal != nullptr && options.p_journal->find(entry.name, progress) && !progress.is_done};
+        berval resume_cookie{progress.cookie.size(), progress.cookie.data()};
+
+        uint64_t start_bytes{progress.start};
+        if (!is_resuming)
+        {
+            writer.beginArray();
+            if (options.p_journal != nullptr)
+                start_bytes = writer.flushedSize();
+        }
+
+        std::atomic<size_t> incomplete_count{0};
+        std::unique_ptr<Pipeline::Ordered<LDAPMessage *>> p_pipeline;
+        auto startPipeline{[&]
+                           {
+                               if (options.decode_workers > 0)
+                                   p_pipeline = createPipeline<LDAPMessage *>(options, writer, [p_ldap, &entry, &options, &incomplete_count](LDAPMessage *&message, JSON::Writer &entry_writer)
+                                                                              {
+                                                                                  if (!writeEntry(p_ldap, message, entry, options, entry_writer))
+                                                                                      incomplete_count++;
+                                                                                  ldap_msgfree(message); });
+                           }};
+        startPipeline();
+
+        uint8_t class_id{options.p_recorder != nullptr ? options.p_recorder->beginClass(entry.name) : uint8_t{}};
+
+        /* Runs where the entries are written, once everything before it is, and is journaled once that is in the file */
+        auto checkpoint{[&writer, &entry, &options, &start_bytes, &incomplete_count](bool is_done, const std::string &cookie)
+                        {
+                            if (incomplete_count > 0)
+                                return;
+
+                            Checkpoint::Progress progress{is_done, writer.flushedSize(), start_bytes, writer.openScopes(), cookie};
+                            writer.whenWritten([p_journal = options.p_journal, name = entry.name, progress]
+                                               { p_journal->update(name, progress); });
+                        }};
+
+        size_t page_count{};
+        bool has_cookie{is_resuming && !progress.cookie.empty()};
+
+        for (;;)
+        {
+            int rc{searchPages(
+                p_ldap, base_dn, classQuery(entry), *options.p_controller, has_cookie ? &resume_cookie : nullptr,
+                [&](LDAPMessage *message)
+                {
+                    if (options.p_recorder != nullptr)
+                        options.p_recorder->record(class_id, p_ldap, message);
+
+                    if (p_pipeline)
+                        p_pipeline->submit(message);
+                    else
+                    {
+                        if (!writeEntry(p_ldap, message, entry, options, writer))
+                            incomplete_count++;
+                        ldap_msgfree(message);
+                    }
+                },
+                [&](const berval *cookie)
+                {
+                    page_count++;
+
+                    if (options.p_journal != nullptr && cookie != nullptr)
+                    {
+                        std::string next_cookie(cookie->bv_val, cookie->bv_len);
+                        if (p_pipeline)
+                            p_pipeline->mark([checkpoint, next_cookie]
+                                             { checkpoint(false, next_cookie); });
+                        else
+                            checkpoint(false, next_cookie);
+                    }
+                    /* The next page is already in flight while this one lands on disk */
+                    else if (!p_pipeline)
+                        writer.flush();
+
+                    if (options.p_recorder != nullptr)
+                        options.p_recorder->flush();
+                })};
+
+            if (rc == 0)
+                break;
+
+            /* Only the resumed cookie failing before its first page is a rejection, anything else fails the class */
+            if (!has_cookie || page_count != 0)
+                return -1;
+
+            std::cerr << "[!] The server does not accept the checkpoint of \"" << entry.name << "\" (cookies only hold on the connection that issued them), restarting it" << std::endl;
+
+            if (p_pipeline)
+                p_pipeline->finish();
+
+            std::vector<bool> start_scopes{progress.scopes};
+            if (start_scopes.empty())
+                return -1;
+            start_scopes.back() = true;
+
+            if (!writer.rewind(start_bytes, start_scopes))
+            {
+                std::cerr << "[x] Failed to cut \"" << entry.name << "\" back to its start" << std::endl;
+                return -1;
+            }
+
+            /* Journaled right away, the file no longer holds what the old checkpoint claims */
+            options.p_journal->update(entry.name, Checkpoint::Progress{false, start_bytes, start_bytes, start_scopes, {}});
+
+            has_cookie = false;
+            startPipeline();
+        }
+
+        if (p_pipeline)
+            p_pipeline->finish();
+
+        writer.endArray();
+
+        if (incomplete_count > 0)
+        {
+            std::cerr << "[x] " << incomplete_count << " entries of \"" << entry.name << "\" are incomplete" << std::endl;
+            return -1;
+        }
+
+        if (options.p_journal != nullptr)
+            checkpoint(true, {});
+
+        return 0;
+    }
+
+    /*
+        Writes the entries a capture holds for one class through the same decoders as searchClass.
+        Malformed entries are skipped, and -1 is returned once the class is written when there was any.
+    */
+    inline int replayClass(const Capture::Reader::Class &capture_class, const ObjectSearch::Entry &entry, const Options &options, JSON::Writer &writer)
+    {
+        writer.beginArray();
+
+        std::atomic<size_t> malformed_count{0};
+        auto decode{[&entry, &options, &malformed_count](berval &encoded, JSON::Writer &entry_writer)
+                    {
+                        if (!writeEncodedEntry(encoded, entry, options, entry_writer))
+                        {
+                            std::cerr << "[!] Malformed captured entry in \"" << entry.name << "\"" << std::endl;
+                            malformed_count++;
+                        }
+                    }};
+
+        if (options.decode_workers > 0)
+        {
+            auto p_pipeline{createPipeline<berval>(options, writer, decode)};
+            for (const berval &encoded : capture_class.entries)
+                p_pipeline->submit(encoded);
+            p_pipeline->finish();
+        }
+        else
+        {
+            for (berval encoded : capture_class.entries)
+                decode(encoded, writer);
+        }
+
+        writer.endArray();
+
+        if (malformed_count > 0)
+        {
+            std::cerr << "[x] " << malformed_count << " captured entries of \"" << entry.name << "\" could not be decoded" << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+    JSON string escaping. Most of what a dump writes is DNs and names with nothing to
+    escape, so the input is scanned 16 or 32 bytes at a time for the bytes that need a
+    look (quotes, backslashes, control characters and anything outside ASCII) and the
+    clean runs between them are appended in one piece. Control characters get their
+    short escape or \u00XX, valid UTF-8 is copied and every byte of invalid UTF-8 is
+    replaced with U+FFFD so the output always parses.
+*/
+namespace Escape
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* Index of the first byte at or after from that needs a look, size when there is none */
+    using Scanner = size_t (*)(const char *data, size_t size, size_t from);
+
+    /* U+FFFD REPLACEMENT CHARACTER */
+    constexpr char REPLACEMENT[]{"\xEF\xBF\xBD"};
+
+    //
+    // [SECTION] Scanners
+    //
+
+    inline bool isSpecial(unsigned char c)
+    {
+        return c < 0x20 || c == '"' || c == '\\' || c >= 0x80;
+    }
+
+    inline size_t scanScalar(const char *data, size_t size, size_t from)
+    {
+        while (from < size && !isSpecial(static_cast<unsigned char>(data[from])))
+            from++;
+        return from;
+    }
+
+#if defined(__SSE2__)
+    /* A signed compare against 0x20 catches control characters and bytes >= 0x80 at once */
+    inline size_t scanSse2(const char *data, size_t size, size_t from)
+    {
+        const __m128i quote{_mm_set1_epi8('"')};
+        const __m128i backslash{_mm_set1_epi8('\\')};
+        const __m128i space{_mm_set1_epi8(0x20)};
+
+        for (; from + 16 <= size; from += 16)
+        {
+            __m128i chunk{_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + from))};
+            __m128i special{_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)), _mm_cmplt_epi8(chunk, space))};
+
+            int mask{_mm_movemask_epi8(special)};
+            if (mask != 0)
+                return from + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+        }
+
+        return scanScalar(data, size, from);
+    }
+#endif
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define ESCAPE_HAS_AVX2 1
+
+    __attribute__((target("avx2"))) inline size_t scanAvx2(const char *data, size_t size, size_t from)
+    {
+        const __m256i quote{_mm256_set1_epi8('"')};
+        const __m256i backslash{_mm256_set1_epi8('\\')};
+        /* 0x20 > byte, signed, as AVX2 only has a greater-than compare (control characters and bytes >= 0x80) */
+        const __m256i space{_mm256_set1_epi8(0x20)};
+
+        for (; from + 32 <= size; from += 32)
+        {
+            __m256i chunk{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + from))};
+            __m256i special{_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+                                            _mm256_cmpgt_epi8(space, chunk))};
+
+            unsigned mask{static_cast<unsigned>(_mm256_movemask_epi8(special))};
+            if (mask != 0)
+                return from + static_cast<size_t>(__builtin_ctz(mask));
+        }
+
+        return scanSse2(data, size, from);
+    }
+#endif
+
+    /* The widest scanner the CPU runs, picked once */
+    inline Scanner scanner()
+    {
+        static const Scanner SCANNER{[]
+                                     {
+#if defined(ESCAPE_HAS_AVX2)
+                                         if (__builtin_cpu_supports("avx2"))
+                                             return &scanAvx2;
+#endif
+#if defined(__SSE2__)
+                                         return &scanSse2;
+#else
+                                         return &scanScalar;
+#endif
+                                     }()};
+
+        return SCANNER;
+    }
+
+    //
+    // [SECTION] Functions
+    //
+
+    /* Length of the well-formed UTF-8 sequence data starts with, 0 when it is not one (overlong, surrogate, above U+10FFFF or cut short) */
+    inline size_t sequenceLength(const unsigned char *data, size_t size)
+    {
+        unsigned char lead{data[0]};
+        size_t length{};
+        unsigned char low{0x80}, high{0xBF};
+
+        if (lead >= 0xC2 && lead <= 0xDF)
+            length = 2;
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            length = 3;
+            if (lead == 0xE0)
+                low = 0xA0;
+            else if (lead == 0xED)
+                high = 0x9F;
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            length = 4;
+            if (lead == 0xF0)
+                low = 0x90;
+            else if (lead == 0xF4)
+                high = 0x8F;
+        }
+        else
+            return 0;
+
+        if (size < length || data[1] < low || data[1] > high)
+            return 0;
+
+        for (size_t i{2}; i < length; i++)
+            if ((data[i] & 0xC0) != 0x80)
+                return 0;
+
+        return length;
+    }
+
+    /* Escapes of the ASCII bytes isSpecial accepts, empty for the others */
+    struct EscapeTable
+    {
+        char text[0x60][6];
+        uint8_t lengths[0x60];
+
+        constexpr EscapeTable() : text(), lengths()
+        {
+            const char DIGITS[]{"0123456789abcdef"};
+            for (int c{}; c < 0x20; c++)
+            {
+                const char escape[]{'\\', 'u', '0', '0', DIGITS[c >> 4], DIGITS[c & 0xF]};
+                for (int i{}; i < 6; i++)
+                    text[c][i] = escape[i];
+                lengths[c] = 6;
+            }
+
+            const char SHORT[][2]{{'\b', 'b'}, {'\f', 'f'}, {'\n', 'n'}, {'\r', 'r'}, {'\t', 't'}, {'"', '"'}, {'\\', '\\'}};
+            for (const auto &[c, letter] : SHORT)
+            {
+                text[static_cast<int>(c)][0] = '\\';
+                text[static_cast<int>(c)][1] = letter;
+                lengths[static_cast<int>(c)] = 2;
+            }
+        }
+    };
+
+    inline constexpr EscapeTable ESCAPES{};
+
+    /* Appends the escaped contents of a JSON string (without its quotes) using scan to skip clean runs */
+    inline void appendWith(Scanner scan, const char *data, size_t size, std::string &output)
+    {
+        const unsigned char *p_bytes{reinterpret_cast<const unsigned char *>(data)};
+        size_t run_start{};
+        size_t position{};
+
+        while ((position = scan(data, size, position)) < size)
+        {
+            unsigned char c{p_bytes[position]};
+
+            /* Valid UTF-8 stays part of the run */
+            if (c >= 0x80)
+            {
+                size_t length{sequenceLength(p_bytes + position, size - position)};
+                if (length != 0)
+                {
+                    position += length;
+                    continue;
+                }
+            }
+
+            if (position != run_start)
+                output.append(data + run_start, position - run_start);
+            if (c >= 0x80)
+                output.append(REPLACEMENT, sizeof(REPLACEMENT) - 1);
+            else
+                output.append(ESCAPES.text[c], ESCAPES.lengths[c]);
+
+            run_start = ++position;
+        }
+
+        output.append(data + run_start, size - run_start);
+    }
+
+    inline void append(const char *data, size_t size, std::string &output)
+    {
+        appendWith(scanner(), data, size, output);
+    }
+}
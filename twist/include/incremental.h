@@ -0,0 +1,354 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <charconv>
+#include <cstdio>
+#include <cstdint>
+
+#include <ldap.h>
+
+#include "object-search.h"
+#include "connection.h"
+#include "capture.h"
+#include "adaptive.h"
+#include "dump.h"
+
+/*
+    Incremental dumps keep the entries of the last run in a capture file (the snapshot)
+    and, next to it, the highestCommittedUSN each DC had when it was read. A later run
+    only asks that DC for objects with a higher uSNChanged and for the tombstones of
+    objects deleted since, then rewrites the snapshot with those changes merged in by
+    objectGUID. The output is rendered from the new snapshot.
+*/
+namespace Incremental
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* USNs are local to the DC that issued them, so one watermark per DC (its dsServiceName) */
+    struct State
+    {
+        std::map<std::string, uint64_t> watermarks;
+    };
+
+    struct Counts
+    {
+        size_t kept;
+        size_t changed;
+        size_t deleted;
+    };
+
+    //
+    // [SECTION] Functions
+    //
+
+    /* One "<usn> <dsServiceName>" line per DC, false when there is no state yet */
+    inline bool loadState(const std::string &path, State &state)
+    {
+        std::ifstream input(path);
+        if (!input)
+            return false;
+
+        std::string line;
+        while (std::getline(input, line))
+        {
+            size_t separator{line.find(' ')};
+            uint64_t usn{};
+            if (separator == std::string::npos || std::from_chars(line.data(), line.data() + separator, usn).ec != std::errc{})
+                continue;
+
+            state.watermarks[line.substr(separator + 1)] = usn;
+        }
+
+        return true;
+    }
+
+    /* Written aside and renamed so a crash never leaves a watermark ahead of its snapshot */
+    inline bool saveState(const std::string &path, const State &state)
+    {
+        std::string temporary_path{path + ".tmp"};
+        {
+            std::ofstream output(temporary_path, std::ios::trunc);
+            for (const auto &[server, usn] : state.watermarks)
+                output << usn << ' ' << server << '\n';
+
+            if (!output.flush())
+                return false;
+        }
+
+        return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+    }
+
+    /* Reads which DC answers and its highestCommittedUSN from the root DSE */
+    inline bool readRootDse(LDAP *p_ldap, std::string &server, uint64_t &highest_usn)
+    {
+        const char *attributes[]{"dsServiceName", "highestCommittedUSN", nullptr};
+        LDAPMessage *p_result{};
+
+        int rc{ldap_search_ext_s(p_ldap, "", LDAP_SCOPE_BASE, "(objectClass=*)", const_cast<char **>(attributes), 0, nullptr, nullptr, nullptr, 1, &p_result)};
+        LDAPMessage *p_entry{rc == LDAP_SUCCESS ? ldap_first_entry(p_ldap, p_result) : nullptr};
+
+        bool is_found{false};
+        if (p_entry != nullptr)
+        {
+            berval **server_values{ldap_get_values_len(p_ldap, p_entry, "dsServiceName")};
+            berval **usn_values{ldap_get_values_len(p_ldap, p_entry, "highestCommittedUSN")};
+
+            if (server_values != nullptr && usn_values != nullptr && server_values[0] != nullptr && usn_values[0] != nullptr)
+            {
+                server.assign(server_values[0]->bv_val, server_values[0]->bv_len);
+                is_found = std::from_chars(usn_values[0]->bv_val, usn_values[0]->bv_val + usn_values[0]->bv_len, highest_usn).ec == std::errc{};
+            }
+
+            ldap_value_free_len(server_values);
+            ldap_value_free_len(usn_values);
+        }
+
+        if (p_result != nullptr)
+            ldap_msgfree(p_result);
+
+        return is_found;
+    }
+
+    inline std::string guidKey(const berval &encoded)
+    {
+        berval guid{};
+        if (!Capture::findValue(encoded, "objectGUID", guid))
+            return {};
+
+        return std::string(guid.bv_val, guid.bv_len);
+    }
+
+    /*
+        Writes the entries of one class to snapshot: the previous ones that neither changed
+        nor were deleted since from_usn, in their previous order with changed entries in
+        place, then the new ones. from_usn 0 (or no previous class) fetches everything,
+        straight into the snapshot as there is nothing to merge.
+    */
+    inline int refreshClass(LDAP *p_ldap, const std::string &base_dn, const ObjectSearch::Entry &entry, uint64_t from_usn, const Capture::Reader::Class *p_previous, Adaptive::Controller &controller, Capture::Recorder &snapshot, Counts &counts)
+    {
+        bool is_delta{from_usn != 0 && p_previous != nullptr};
+        std::string usn_filter{"(uSNChanged>=" + std::to_string(from_usn) + ")"};
+
+        Dump::Query query{Dump::classQuery(entry)};
+        /* Entries are matched across runs by objectGUID, decoders skip it */
+        query.attributes.insert(query.attributes.end() - 1, "objectGUID");
+        if (!is_delta)
+        {
+            uint8_t class_id{snapshot.beginClass(entry.name)};
+
+            int rc{Dump::searchPages(
+                p_ldap, base_dn, query, controller, nullptr,
+                [&](LDAPMessage *message)
+                {
+                    thread_local std::string encoded;
+                    if (Capture::encodeEntry(p_ldap, message, encoded))
+                    {
+                        snapshot.append(class_id, encoded.data(), encoded.size());
+                        counts.changed++;
+                    }
+                    ldap_msgfree(message);
+                },
+                [](const berval *) {})};
+
+            return rc != 0 ? -1 : 0;
+        }
+
+        query.filter = "(&" + query.filter + usn_filter + ")";
+
+        std::vector<std::string> changed;
+        std::unordered_map<std::string, size_t> changed_indices;
+
+        int rc{Dump::searchPages(
+            p_ldap, base_dn, query, controller, nullptr,
+            [&](LDAPMessage *message)
+            {
+                std::string encoded;
+                if (Capture::encodeEntry(p_ldap, message, encoded))
+                {
+                    changed_indices[guidKey({encoded.size(), encoded.data()})] = changed.size();
+                    changed.push_back(std::move(encoded));
+                }
+                ldap_msgfree(message);
+            },
+            [](const berval *) {})};
+
+        if (rc != 0)
+            return -1;
+
+        std::unordered_set<std::string> deleted;
+
+        /* Tombstones keep objectGUID and objectClass, only deletions since the watermark are returned */
+        Dump::Query deleted_query{entry.name, "(&(objectClass=" + std::string(entry.objectClass) + ")(isDeleted=TRUE)" + usn_filter + ")", {"objectGUID", nullptr}, true};
+
+        rc = Dump::searchPages(
+            p_ldap, base_dn, deleted_query, controller, nullptr,
+            [&](LDAPMessage *message)
+            {
+                berval **values{ldap_get_values_len(p_ldap, message, "objectGUID")};
+                if (values != nullptr && values[0] != nullptr)
+                    deleted.emplace(values[0]->bv_val, values[0]->bv_len);
+                ldap_value_free_len(values);
+                ldap_msgfree(message);
+            },
+            [](const berval *) {});
+
+        if (rc != 0)
+            return -1;
+
+        uint8_t class_id{snapshot.beginClass(entry.name)};
+        std::vector<bool> is_written(changed.size(), false);
+
+        for (const berval &encoded : p_previous->entries)
+        {
+            std::string key{guidKey(encoded)};
+
+            if (deleted.count(key) != 0)
+            {
+                counts.deleted++;
+                continue;
+            }
+
+            auto changed_entry{key.empty() ? changed_indices.end() : changed_indices.find(key)};
+            if (changed_entry == changed_indices.end())
+            {
+                snapshot.append(class_id, encoded.bv_val, encoded.bv_len);
+                counts.kept++;
+                continue;
+            }
+
+            if (!is_written[changed_entry->second])
+            {
+                const std::string &update{changed[changed_entry->second]};
+                snapshot.append(class_id, update.data(), update.size());
+                is_written[changed_entry->second] = true;
+                counts.changed++;
+            }
+        }
+
+        for (size_t i{}; i < changed.size(); i++)
+        {
+            if (is_written[i])
+                continue;
+
+            snapshot.append(class_id, changed[i].data(), changed[i].size());
+            counts.changed++;
+        }
+
+        return 0;
+    }
+
+    /*
+        Brings the snapshot at path up to date, classes are refreshed concurrently on the
+        sessions of pool. Falls back to fetching everything when there is no snapshot, no
+        watermark for the DC answering, or the DC exposes no highestCommittedUSN.
+    */
+    inline bool update(Connection::Pool &pool, const std::string &base_dn, const ObjectSearch::List &searches, Adaptive::Controller &controller, const std::string &path)
+    {
+        std::string state_path{path + ".state"};
+        std::string server;
+        uint64_t highest_usn{};
+
+        /* Read before searching, changes made during the run are fetched again next time */
+        LDAP *p_ldap{pool.acquire()};
+        bool has_usn{readRootDse(p_ldap, server, highest_usn)};
+        pool.release(p_ldap);
+
+        State state;
+        bool has_state{has_usn && loadState(state_path, state)};
+
+        uint64_t from_usn{};
+        Capture::Reader previous;
+        bool has_previous{false};
+
+        if (!has_usn)
+            std::cerr << "[!] The server exposes no highestCommittedUSN, dumping everything" << std::endl;
+        else if (has_state && state.watermarks.count(server) != 0)
+        {
+            has_previous = previous.open(path);
+            if (has_previous)
+                from_usn = state.watermarks[server] + 1;
+            else
+                std::cerr << "[!] Could not read the previous snapshot " << path << ", dumping everything" << std::endl;
+        }
+
+        if (from_usn != 0)
+            std::cout << "[*] Fetching changes since USN " << from_usn << " from " << server << std::endl;
+
+        std::string temporary_path{path + ".tmp"};
+        Capture::Recorder snapshot;
+        if (!snapshot.open(temporary_path))
+        {
+            std::cerr << "[x] Failed to open snapshot " << temporary_path << std::endl;
+            return false;
+        }
+
+        std::vector<int> results(searches.size(), 0);
+        std::vector<Counts> counts(searches.size(), Counts{});
+        std::atomic<size_t> next_task{0};
+        std::vector<std::thread> workers;
+
+        for (size_t i{}; i < std::min(pool.size(), searches.size()); i++)
+        {
+            workers.emplace_back([&]
+                                 {
+                for (size_t task{next_task++}; task < searches.size(); task = next_task++)
+                {
+                    const auto &entry{searches[task]};
+                    LDAP *p_session{pool.acquire()};
+                    results[task] = refreshClass(p_session, base_dn, entry, from_usn, has_previous ? previous.find(entry.name) : nullptr, controller, snapshot, counts[task]);
+                    pool.release(p_session);
+                } });
+        }
+
+        for (auto &worker : workers)
+            worker.join();
+
+        /* The previous snapshot and its watermarks are kept unless the new one is complete on disk */
+        if (!snapshot.close())
+        {
+            std::cerr << "[x] Failed to write snapshot " << temporary_path << ", " << path << " is left as it was" << std::endl;
+            std::remove(temporary_path.c_str());
+            return false;
+        }
+
+        for (size_t task{}; task < searches.size(); task++)
+        {
+            if (results[task] != 0)
+            {
+                std::remove(temporary_path.c_str());
+                return false;
+            }
+
+            std::cout << "[*] " << searches[task].name << ": " << counts[task].changed << " fetched, " << counts[task].kept << " unchanged, " << counts[task].deleted << " deleted" << std::endl;
+        }
+
+        if (std::rename(temporary_path.c_str(), path.c_str()) != 0)
+        {
+            std::cerr << "[x] Failed to replace snapshot " << path << std::endl;
+            return false;
+        }
+
+        if (!has_usn)
+            return true;
+
+        /* Other DCs' watermarks stay valid after a delta, as they only ever ask for more than needed */
+        if (from_usn == 0)
+            state.watermarks.clear();
+        state.watermarks[server] = highest_usn;
+
+        if (!saveState(state_path, state))
+            std::cerr << "[!] Failed to save " << state_path << ", the next run fetches more changes than needed" << std::endl;
+
+        return true;
+    }
+}
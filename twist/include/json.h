@@ -1,203 +1,309 @@
 #pragma once
 
-#include <map>
+#include <functional>
+#include <charconv>
+#include <cmath>
+#include <istream>
+#include <vector>
 #include <string>
-#include <sstream>
-#include <variant>
-#include <memory>
+#include <cstring>
+#include <cstdint>
+
+#include "escape.h"
+#include "output.h"
 
 namespace JSON
 {
-    class Object;
-
-    enum class ValueType
+    /*
+        Indent levels that do not indent: COMPACT writes everything on one line, LINES
+        does too but puts each value of the outermost array on a line of its own and
+        leaves out the array's brackets (NDJSON). Writers rendering part of a document
+        at its depth() get COMPACT in both cases.
+    */
+    constexpr int COMPACT{-1};
+    constexpr int LINES{-2};
+
+    class Writer
     {
-        STRING,
-        INT,
-        OBJECT,
-        ARRAY
-    };
+    public:
+        /* When p_sink is null the writer only accumulates into its buffer (see take()) */
+        Writer(Output::Sink *p_sink = nullptr, int indent_level = 0, size_t flush_threshold = 1 << 20)
+            : p_sink(p_sink), indent_level(indent_level), flush_threshold(flush_threshold) {}
 
-    struct Value
-    {
-        ValueType type;
-        std::variant<std::string, int, std::unique_ptr<Object>, std::vector<Value>> value;
-
-        Value(ValueType t, std::string s) : type(t), value(std::move(s)) {}
-        Value(ValueType t, int i) : type(t), value(i) {}
-        Value(ValueType t, std::unique_ptr<Object> obj) : type(t), value(std::move(obj)) {}
-        Value(ValueType t, std::vector<Value> arr) : type(t), value(std::move(arr)) {}
-        Value() : type(ValueType::STRING), value(std::string{}) {}
-        Value(Value &&other) noexcept : type(other.type), value(std::move(other.value)) {}
-    };
+        ~Writer()
+        {
+            flush();
+        }
 
-    class Object
-    {
-    public:
-        std::string arrayToString(std::vector<Value> &value, int indent_level = 0)
+        void beginObject()
         {
-            std::ostringstream oss;
-            std::string base_indent{generateIndent(indent_level)};
+            open('{');
+        }
 
-            oss << "[\n";
+        void endObject()
+        {
+            close('}');
+        }
+
+        void beginArray()
+        {
+            open('[');
+        }
 
-            bool first_entry{true};
+        void endArray()
+        {
+            close(']');
+        }
 
-            for (auto &entry : value)
-            {
-                if (!first_entry)
-                    oss << ",\n";
-
-                oss << base_indent << "    ";
-
-                switch (entry.type)
-                {
-                case ValueType::STRING:
-                    oss << "\"" << escape(std::get<std::string>(entry.value)) << "\"";
-                    break;
-                case ValueType::INT:
-                    oss << std::to_string(std::get<int>(entry.value));
-                    break;
-                case ValueType::OBJECT:
-                    oss << std::get<std::unique_ptr<Object>>(entry.value)->toString(indent_level + 1);
-                    break;
-                case ValueType::ARRAY:
-                    oss << arrayToString(std::get<std::vector<Value>>(entry.value), indent_level + 1);
-                    break;
-                }
-
-                first_entry = false;
-            }
+        void key(const std::string &name)
+        {
+            key(name.data(), name.size());
+        }
+
+        void key(const char *name, size_t length)
+        {
+            separate();
+            buffer += '"';
+            buffer.append(name, length);
+            buffer += indent_level < 0 ? "\":" : "\": ";
+            pending_key = true;
+        }
+
+        void value(const std::string &value)
+        {
+            this->value(value.data(), value.size());
+        }
+
+        void value(const char *value)
+        {
+            this->value(value, strlen(value));
+        }
 
-            oss << "\n"
-                << base_indent << "]";
+        void value(const char *data, size_t size)
+        {
+            beginValue();
+            buffer += '"';
+            escape(data, size, buffer);
+            buffer += '"';
+            endValue();
+        }
 
-            return oss.str();
+        void value(int value)
+        {
+            beginValue();
+            buffer += std::to_string(value);
+            endValue();
         }
 
-        std::string toString(int indent_level = 0)
+        void value(int64_t value)
         {
-            std::ostringstream oss;
-            std::string base_indent{generateIndent(indent_level)};
+            beginValue();
+            buffer += std::to_string(value);
+            endValue();
+        }
 
-            oss << "{\n";
+        void value(uint64_t value)
+        {
+            beginValue();
+            buffer += std::to_string(value);
+            endValue();
+        }
 
-            bool first_entry{true};
+        void value(bool value)
+        {
+            beginValue();
+            buffer += value ? "true" : "false";
+            endValue();
+        }
 
-            for (auto &entry : map)
+        /* Shortest form that reads back the same, null when not finite */
+        void value(double value)
+        {
+            beginValue();
+            if (std::isfinite(value))
             {
-                if (!first_entry)
-                    oss << ",\n";
-
-                oss << base_indent << "    \"" << entry.first << "\": ";
-
-                switch (entry.second.type)
-                {
-                case ValueType::STRING:
-                    oss << "\"" << escape(std::get<std::string>(entry.second.value)) << "\"";
-                    break;
-                case ValueType::INT:
-                    oss << std::to_string(std::get<int>(entry.second.value));
-                    break;
-                case ValueType::OBJECT:
-                    oss << std::get<std::unique_ptr<Object>>(entry.second.value)->toString(indent_level + 1);
-                    break;
-                case ValueType::ARRAY:
-                    oss << arrayToString(std::get<std::vector<Value>>(entry.second.value), indent_level + 1);
-                    break;
-                }
-
-                first_entry = false;
+                char digits[32];
+                buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
             }
+            else
+                buffer += "null";
+            endValue();
+        }
+
+        /* Writes a value that was already serialized (e.g. by another writer) */
+        void raw(const char *data, size_t size)
+        {
+            beginValue();
+            buffer.append(data, size);
+            endValue();
+        }
+
+        /* Copies an already serialized value from input without loading it whole */
+        void raw(std::istream &input)
+        {
+            beginValue();
+
+            char chunk[1 << 16];
+            while (input.read(chunk, sizeof(chunk)) || input.gcount() > 0)
+            {
+                buffer.append(chunk, static_cast<size_t>(input.gcount()));
+                flushIfFull();
+            }
+
+            endValue();
+        }
+
+        /* Hands the buffer over to the sink, the writer continues in one the sink gives back */
+        void flush()
+        {
+            if (p_sink == nullptr || buffer.empty())
+                return;
+
+            p_sink->write(buffer);
+        }
 
-            oss << "\n"
-                << base_indent << "}";
+        /* Flushes and returns how much of the document the sink took, i.e. where it will end once written */
+        uint64_t flushedSize()
+        {
+            flush();
+            return p_sink != nullptr ? p_sink->size() : 0;
+        }
 
-            return oss.str();
+        /* Flushes and runs callback once all of it is in the file (right away without a sink) */
+        void whenWritten(std::function<void()> callback)
+        {
+            flush();
+            if (p_sink != nullptr)
+                p_sink->whenWritten(std::move(callback));
+            else
+                callback();
         }
 
-        std::string getStringValue(std::string &key)
+        /* Containers currently open, true while still empty */
+        const std::vector<bool> &openScopes() const
         {
-            return std::get<std::string>(map[key].value);
+            return scopes;
         }
 
-        int getIntValue(std::string &key)
+        /* Continues a document whose beginning is already in the stream, with open_scopes as left by openScopes() */
+        void restore(const std::vector<bool> &open_scopes)
         {
-            return std::get<int>(map[key].value);
+            scopes = open_scopes;
+            pending_key = false;
         }
 
-        Object &getObjectValue(std::string &key)
+        /* Drops what was written past size (a flushedSize() taken earlier) and continues there with open_scopes */
+        bool rewind(uint64_t size, const std::vector<bool> &open_scopes)
         {
-            return *std::get<std::unique_ptr<Object>>(map[key].value);
+            buffer.clear();
+            restore(open_scopes);
+            return p_sink != nullptr && p_sink->truncate(size);
         }
 
-        void setValue(const std::string &key, const std::string &value)
+        /* Indentation level of the next value, for rendering it with a separate writer */
+        int depth() const
         {
-            map[key].type = ValueType::STRING;
-            map[key].value = value;
+            return indent_level < 0 ? COMPACT : indent_level + static_cast<int>(scopes.size());
         }
 
-        void setValue(const std::string &key, int value)
+        std::string take()
         {
-            map[key].type = ValueType::INT;
-            map[key].value = value;
+            std::string output{std::move(buffer)};
+            buffer.clear();
+            return output;
         }
 
-        void setValue(const std::string &key, std::unique_ptr<Object> value)
+        static void escape(const std::string &input, std::string &output)
         {
-            map[key].type = ValueType::OBJECT;
-            map[key].value = std::move(value);
+            escape(input.data(), input.size(), output);
         }
 
-        void setValue(const std::string &key, std::vector<Value> &value)
+        static void escape(const char *data, size_t size, std::string &output)
         {
-            map[key].type = ValueType::ARRAY;
-            map[key].value = std::move(value);
+            Escape::append(data, size, output);
         }
 
     private:
-        std::map<std::string, Value> map;
+        Output::Sink *p_sink;
+        int indent_level;
+        size_t flush_threshold;
+        std::string buffer;
+        /* One flag per open container telling whether it is still empty */
+        std::vector<bool> scopes;
+        bool pending_key{false};
+
+        void indent(size_t depth)
+        {
+            if (indent_level >= 0)
+                buffer.append((indent_level + depth) * 4, ' ');
+        }
 
-        std::string escape(const std::string &input)
+        /* Values of the outermost array of a LINES document, which are lines rather than elements */
+        bool isLine() const
         {
-            std::string output;
+            return indent_level == LINES && scopes.size() == 1;
+        }
 
-            for (char c : input)
+        /* Emits the separator and indentation preceding an array element or object key */
+        void separate()
+        {
+            if (scopes.empty())
+                return;
+
+            if (indent_level < 0)
+            {
+                if (!scopes.back() && !isLine())
+                    buffer += ',';
+            }
+            else
             {
-                switch (c)
-                {
-                case '"':
-                    output += "\\\"";
-                    break;
-                case '\\':
-                    output += "\\\\";
-                    break;
-                case '\n':
-                    output += "\\n";
-                    break;
-                case '\r':
-                    output += "\\r";
-                    break;
-                case '\t':
-                    output += "\\t";
-                    break;
-                default:
-                    output += c;
-                    break;
-                }
+                buffer += scopes.back() ? "\n" : ",\n";
+                indent(scopes.size());
             }
 
-            return output;
+            scopes.back() = false;
         }
 
-        std::string generateIndent(int level)
+        void beginValue()
         {
-            std::ostringstream oss;
+            if (pending_key)
+                pending_key = false;
+            else
+                separate();
+        }
 
-            for (int i{}; i < level; i++)
-                oss << "    ";
+        void endValue()
+        {
+            if (isLine())
+                buffer += '\n';
+            flushIfFull();
+        }
 
-            return oss.str();
+        void flushIfFull()
+        {
+            if (p_sink != nullptr && buffer.size() >= flush_threshold)
+                flush();
+        }
+
+        void open(char bracket)
+        {
+            beginValue();
+            if (indent_level != LINES || !scopes.empty())
+                buffer += bracket;
+            scopes.push_back(true);
+        }
+
+        void close(char bracket)
+        {
+            scopes.pop_back();
+            if (indent_level >= 0)
+            {
+                buffer += '\n';
+                indent(scopes.size());
+            }
+            if (indent_level != LINES || !scopes.empty())
+                buffer += bracket;
+            endValue();
         }
     };
-}
\ No newline at end of file
+}
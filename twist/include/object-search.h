@@ -1,18 +1,25 @@
 #pragma once
 
-#include <unordered_map>
+#include <array>
 #include <vector>
 #include <string>
-#include <ctime>
-#include <iomanip>
-#include <sstream>
-#include <string>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 
 #include <ldap.h>
 
 #include "windows-types.h"
+#include "sid-table.h"
+#include "document.h"
 #include "json.h"
 
+namespace Dump
+{
+    struct Options;
+}
+
 namespace ObjectSearch
 {
     //
@@ -29,102 +36,326 @@ namespace ObjectSearch
         BINARY_SECURITY_DESCRIPTOR
     };
 
+    constexpr size_t ATTRIBUTE_TYPE_COUNT{6};
+    /* How class files and run statistics name each type, in enumeration order */
+    constexpr const char *ATTRIBUTE_TYPE_NAMES[ATTRIBUTE_TYPE_COUNT]{"string", "sid", "filetime", "multi_value", "enumeration", "security_descriptor"};
+
     struct Attribute
     {
         const char *name;
         AttributeType type;
     };
 
+    struct Entry;
+
+    /* Writes one entry (named dn) of class from a BerElement positioned on its attribute list, false when it is malformed or values could not be fetched */
+    using EntryWriter = bool (*)(BerElement *p_ber, const berval &dn, const Entry &class_entry, const Dump::Options &options, JSON::Writer &writer);
+
+    /* Runtime view of an object class schema (see schemas.h), possibly narrowed by a profile (see profiles.h) */
     struct Entry
     {
+        const char *name;
         const char *objectClass;
+        /* The attributes requested */
         std::vector<Attribute> attributes;
+        EntryWriter writeEntry;
+        /* For compiled decoders, bit i is set when the schema's i-th attribute is among attributes */
+        uint64_t schema_mask;
     };
 
-    using Map = std::unordered_map<std::string, Entry>;
+    using List = std::vector<Entry>;
 
     //
     // [SECTION] Functions
     //
 
-    std::string parseFiletime(const struct berval *value)
+    /* Largest rendering of a valid SID: "S-1-" + 48-bit authority + 15 sub-authorities */
+    constexpr size_t SID_BUFFER_SIZE{4 + 15 + 15 * 11 + 1};
+    constexpr size_t GUID_BUFFER_SIZE{36};
+    /* "YYYYY-MM-DD HH:MM:SS UTC" for any 64-bit FILETIME */
+    constexpr size_t FILETIME_BUFFER_SIZE{32};
+
+    /* Two lowercase hex digits for each byte value */
+    struct HexTable
     {
-        if (value == nullptr || value->bv_val == nullptr)
-            return "Invalid";
+        char digits[256][2];
 
-        std::string filetime_str(value->bv_val, value->bv_len);
-        uint64_t filetime{};
-        try
+        constexpr HexTable() : digits{}
         {
-            filetime = std::stoull(filetime_str);
+            const char *hex{"0123456789abcdef"};
+            for (int i{}; i < 256; i++)
+            {
+                digits[i][0] = hex[i >> 4];
+                digits[i][1] = hex[i & 0xF];
+            }
         }
-        catch (...)
+    };
+
+    inline constexpr HexTable HEX_TABLE{};
+
+    inline uint32_t readUint32(const uint8_t *data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    /* Writes the SID string into buffer (SID_BUFFER_SIZE bytes), returns its length or 0 when invalid */
+    inline size_t formatSid(const uint8_t *sid, size_t size, char *buffer)
+    {
+        if (size < 8 || sid[0] != 1 || sid[1] > 15 || size < static_cast<size_t>(8 + sid[1] * 4))
+            return 0;
+
+        uint64_t authority{};
+        for (int i{}; i < 6; i++)
+            authority = (authority << 8) | sid[2 + i];
+
+        char *p_end{buffer + SID_BUFFER_SIZE};
+        char *p_out{buffer};
+        *p_out++ = 'S';
+        *p_out++ = '-';
+        *p_out++ = '1';
+        *p_out++ = '-';
+        p_out = std::to_chars(p_out, p_end, authority).ptr;
+
+        for (int i{}; i < sid[1]; i++)
         {
-            return "Invalid";
+            *p_out++ = '-';
+            p_out = std::to_chars(p_out, p_end, readUint32(sid + 8 + i * 4)).ptr;
         }
 
-        if (filetime == 0 || filetime == 0x7FFFFFFFFFFFFFFF)
-            return "Never";
+        return static_cast<size_t>(p_out - buffer);
+    }
 
-        const uint64_t FILETIME_TO_UNIX_OFFSET{11644473600ULL};
-        uint64_t seconds{(filetime / 10000000ULL) - FILETIME_TO_UNIX_OFFSET};
+    /* Writes the 16 byte mixed-endian GUID as 8-4-4-4-12 lowercase hex into buffer (GUID_BUFFER_SIZE bytes) */
+    inline void formatGuid(const uint8_t *guid, char *buffer)
+    {
+        /* data1, data2 and data3 are little-endian, data4 is a plain byte string */
+        static constexpr uint8_t ORDER[16]{3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15};
 
-        std::time_t time{static_cast<std::time_t>(seconds)};
-        std::tm *tm{std::gmtime(&time)};
+        char *p_out{buffer};
+        for (int i{}; i < 16; i++)
+        {
+            if (i == 4 || i == 6 || i == 8 || i == 10)
+                *p_out++ = '-';
 
-        std::ostringstream oss;
-        oss << std::put_time(tm, "%Y-%m-%d %H:%M:%S UTC");
-        return oss.str();
+            const char *p_digits{HEX_TABLE.digits[guid[ORDER[i]]]};
+            *p_out++ = p_digits[0];
+            *p_out++ = p_digits[1];
+        }
+    }
+
+    /* Days since 1970-01-01 to a proleptic Gregorian date (Howard Hinnant's civil_from_days) */
+    inline void civilFromDays(int64_t days, int64_t &year, unsigned &month, unsigned &day)
+    {
+        days += 719468;
+        int64_t era{(days >= 0 ? days : days - 146096) / 146097};
+        unsigned day_of_era{static_cast<unsigned>(days - era * 146097)};
+        unsigned year_of_era{(day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365};
+        unsigned day_of_year{day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100)};
+        unsigned shifted_month{(5 * day_of_year + 2) / 153};
+
+        day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+        month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+        year = static_cast<int64_t>(year_of_era) + era * 400 + (month <= 2);
     }
 
-    std::string parseSid(const struct berval *value)
+    /* Zero padded two digit field */
+    inline char *writeTwoDigits(char *p_out, unsigned value)
     {
-        if (value == nullptr || value->bv_val == nullptr || value->bv_len < 8)
+        *p_out++ = static_cast<char>('0' + value / 10);
+        *p_out++ = static_cast<char>('0' + value % 10);
+        return p_out;
+    }
+
+    /*
+        Writes a FILETIME attribute (decimal 100ns ticks since 1601) into buffer
+        (FILETIME_BUFFER_SIZE bytes) and returns its length, "Never" and "Invalid"
+        are written for the sentinel and malformed values.
+    */
+    inline size_t formatFiletime(const char *value, size_t size, char *buffer)
+    {
+        auto copy{[buffer](const char *text, size_t length)
+                  {
+                      memcpy(buffer, text, length);
+                      return length;
+                  }};
+
+        uint64_t filetime{};
+        if (value == nullptr || std::from_chars(value, value + size, filetime).ec != std::errc{})
+            return copy("Invalid", 7);
+
+        if (filetime == 0 || filetime == 0x7FFFFFFFFFFFFFFF)
+            return copy("Never", 5);
+
+        const int64_t FILETIME_TO_UNIX_OFFSET{11644473600LL};
+        int64_t seconds{static_cast<int64_t>(filetime / 10000000ULL) - FILETIME_TO_UNIX_OFFSET};
+
+        int64_t days{seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400};
+        unsigned second_of_day{static_cast<unsigned>(seconds - days * 86400)};
+
+        int64_t year{};
+        unsigned month{}, day{};
+        civilFromDays(days, year, month, day);
+
+        char *p_out{buffer};
+        if (year < 1000)
+            for (int64_t digits{year < 10 ? 3 : year < 100 ? 2 : 1}; digits > 0; digits--)
+                *p_out++ = '0';
+        p_out = std::to_chars(p_out, buffer + FILETIME_BUFFER_SIZE, year).ptr;
+        *p_out++ = '-';
+        p_out = writeTwoDigits(p_out, month);
+        *p_out++ = '-';
+        p_out = writeTwoDigits(p_out, day);
+        *p_out++ = ' ';
+        p_out = writeTwoDigits(p_out, second_of_day / 3600);
+        *p_out++ = ':';
+        p_out = writeTwoDigits(p_out, second_of_day / 60 % 60);
+        *p_out++ = ':';
+        p_out = writeTwoDigits(p_out, second_of_day % 60);
+        memcpy(p_out, " UTC", 4);
+
+        return static_cast<size_t>(p_out + 4 - buffer);
+    }
+
+    inline std::string parseFiletime(const struct berval *value)
+    {
+        if (value == nullptr || value->bv_val == nullptr)
             return "Invalid";
 
-        const uint8_t *sid{reinterpret_cast<uint8_t *>(value->bv_val)};
+        char buffer[FILETIME_BUFFER_SIZE];
+        return std::string(buffer, formatFiletime(value->bv_val, value->bv_len, buffer));
+    }
 
-        if (sid[0] != 1)
+    inline std::string parseSid(const struct berval *value)
+    {
+        if (value == nullptr || value->bv_val == nullptr)
             return "Invalid";
 
-        uint8_t subauth_count{sid[1]};
-        if (value->bv_len < static_cast<size_t>(8 + (subauth_count * 4)))
+        char buffer[SID_BUFFER_SIZE];
+        size_t length{formatSid(reinterpret_cast<const uint8_t *>(value->bv_val), value->bv_len, buffer)};
+        if (length == 0)
             return "Invalid";
 
-        uint64_t authority = 0;
-        for (int i = 0; i < 6; i++)
-            authority = (authority << 8) | sid[2 + i];
+        return std::string(buffer, length);
+    }
 
-        std::ostringstream oss;
-        oss << "S-" << static_cast<int>(sid[0]) << "-" << authority;
+    inline std::string parseGuid(const uint8_t *guid)
+    {
+        char buffer[GUID_BUFFER_SIZE];
+        formatGuid(guid, buffer);
+        return std::string(buffer, GUID_BUFFER_SIZE);
+    }
 
-        for (int i = 0; i < subauth_count; i++)
+    /* The SID string, or its index in p_sid_table when one is given */
+    inline Document::Value sidValue(Document::Document &document, const struct berval *value, SidTable::Interner *p_sid_table)
+    {
+        if (p_sid_table != nullptr)
+            return Document::Document::integer(p_sid_table->intern(value));
+
+        char buffer[SID_BUFFER_SIZE];
+        size_t length{formatSid(reinterpret_cast<const uint8_t *>(value->bv_val), value->bv_len, buffer)};
+        return length == 0 ? document.string("Invalid") : document.string({buffer, length});
+    }
+
+    inline Document::Value guidValue(Document::Document &document, const uint8_t *guid)
+    {
+        char buffer[GUID_BUFFER_SIZE];
+        formatGuid(guid, buffer);
+        return document.string({buffer, GUID_BUFFER_SIZE});
+    }
+
+    /* One ACE, its members in the (alphabetical) order descriptors have always been written in */
+    inline Document::Value parseAce(Document::Document &document, const ACE_Header *p_ace_header, SidTable::Interner *p_sid_table)
+    {
+        using Document::Value;
+
+        const uint8_t *p_ace{reinterpret_cast<const uint8_t *>(p_ace_header)};
+        Value access_mask, object_flags, object_type_guid, inherited_object_type_guid, trustee;
+        bool is_known{true};
+
+        auto sidAt{[&](size_t sid_offset)
+                   {
+                       berval sid_berval;
+                       sid_berval.bv_val = const_cast<char *>(reinterpret_cast<const char *>(p_ace + sid_offset));
+                       sid_berval.bv_len = p_ace_header->size - sid_offset;
+                       return sidValue(document, &sid_berval, p_sid_table);
+                   }};
+
+        if (p_ace_header->type == ACE_Type::ACCESS_ALLOWED_ACE_TYPE ||
+            p_ace_header->type == ACE_Type::ACCESS_DENIED_ACE_TYPE)
+        {
+            if (p_ace_header->size >= sizeof(ACE_Header) + sizeof(uint32_t) + 8)
+            {
+                uint32_t mask{};
+                memcpy(&mask, p_ace + sizeof(ACE_Header), sizeof(mask));
+                access_mask = Document::Document::unsignedInteger(mask);
+                trustee = sidAt(sizeof(ACE_Header) + sizeof(uint32_t));
+            }
+        }
+        else if (p_ace_header->type == ACE_Type::ACCESS_ALLOWED_OBJECT_ACE_TYPE ||
+                 p_ace_header->type == ACE_Type::ACCESS_DENIED_OBJECT_ACE_TYPE)
         {
-            uint32_t subauth{};
-            int offset{8 + (i * 4)};
+            if (p_ace_header->size >= sizeof(ACE_Header) + sizeof(uint32_t) + sizeof(uint32_t))
+            {
+                uint32_t mask{}, flags{};
+                memcpy(&mask, p_ace + sizeof(ACE_Header), sizeof(mask));
+                memcpy(&flags, p_ace + sizeof(ACE_Header) + sizeof(uint32_t), sizeof(flags));
+                access_mask = Document::Document::unsignedInteger(mask);
+                object_flags = Document::Document::unsignedInteger(flags);
 
-            subauth = sid[offset] |
-                      (sid[offset + 1] << 8) |
-                      (sid[offset + 2] << 16) |
-                      (sid[offset + 3] << 24);
+                size_t sid_offset{sizeof(ACE_Header) + sizeof(uint32_t) + sizeof(uint32_t)};
 
-            oss << "-" << subauth;
+                if ((flags & 0x1) && (sid_offset + 16 <= p_ace_header->size))
+                {
+                    object_type_guid = guidValue(document, p_ace + sid_offset);
+                    sid_offset += 16;
+                }
+
+                if ((flags & 0x2) && (sid_offset + 16 <= p_ace_header->size))
+                {
+                    inherited_object_type_guid = guidValue(document, p_ace + sid_offset);
+                    sid_offset += 16;
+                }
+
+                if (sid_offset + 8 <= p_ace_header->size)
+                    trustee = sidAt(sid_offset);
+            }
         }
+        else
+            is_known = false;
 
-        return oss.str();
+        Value ace{Document::Document::object()};
+        auto setPresent{[&document, &ace](const char *key, const Value &value)
+                        {
+                            if (value.type != Document::Type::NULL_VALUE)
+                                document.set(ace, key, value);
+                        }};
+
+        setPresent("access_mask", access_mask);
+        document.set(ace, "flags", Document::Document::unsignedInteger(p_ace_header->flags));
+        setPresent("inherited_object_type_guid", inherited_object_type_guid);
+        setPresent("object_flags", object_flags);
+        setPresent("object_type_guid", object_type_guid);
+        if (!is_known)
+            document.set(ace, "raw_data", Document::Document::integer(1));
+        document.set(ace, "size", Document::Document::unsignedInteger(p_ace_header->size));
+        setPresent("trustee", trustee);
+        document.set(ace, "type", Document::Document::unsignedInteger(static_cast<uint8_t>(p_ace_header->type)));
+
+        return ace;
     }
 
-    std::unique_ptr<JSON::Object> parseSecurityDescriptor(const struct berval *value)
+    /* Builds the descriptor in document, the value lives until document is cleared */
+    inline Document::Value parseSecurityDescriptor(const struct berval *value, Document::Document &document, SidTable::Interner *p_sid_table = nullptr)
     {
-        std::unique_ptr<JSON::Object> result{std::make_unique<JSON::Object>()};
+        using Document::Value;
+
+        Value result{Document::Document::object()};
 
         if (value == nullptr || value->bv_val == nullptr || value->bv_len < sizeof(SecurityDescriptorRelative))
-            return std::move(result);
+            return result;
 
         SecurityDescriptorRelative *p_security_descriptor = reinterpret_cast<SecurityDescriptorRelative *>(value->bv_val);
-
-        result->setValue("revision", static_cast<int>(p_security_descriptor->revision));
-        result->setValue("control", static_cast<int>(p_security_descriptor->control));
+        Value owner, group, dacl;
 
         if (p_security_descriptor->owner_offset != 0)
         {
@@ -134,7 +365,7 @@ namespace ObjectSearch
                 berval owner_berval;
                 owner_berval.bv_val = value->bv_val + p_security_descriptor->owner_offset;
                 owner_berval.bv_len = value->bv_len - p_security_descriptor->owner_offset;
-                result->setValue("owner", parseSid(&owner_berval));
+                owner = sidValue(document, &owner_berval, p_sid_table);
             }
         }
 
@@ -146,7 +377,7 @@ namespace ObjectSearch
                 berval group_berval;
                 group_berval.bv_val = value->bv_val + p_security_descriptor->group_offset;
                 group_berval.bv_len = value->bv_len - p_security_descriptor->group_offset;
-                result->setValue("group", parseSid(&group_berval));
+                group = sidValue(document, &group_berval, p_sid_table);
             }
         }
 
@@ -156,12 +387,7 @@ namespace ObjectSearch
             {
                 ACL *p_dacl = reinterpret_cast<ACL *>(value->bv_val + p_security_descriptor->dacl_offset);
 
-                std::unique_ptr<JSON::Object> dacl_obj{std::make_unique<JSON::Object>()};
-                dacl_obj->setValue("revision", static_cast<int>(p_dacl->revision));
-                dacl_obj->setValue("size", static_cast<int>(p_dacl->acl_size));
-                dacl_obj->setValue("ace_count", static_cast<int>(p_dacl->ace_count));
-
-                std::vector<JSON::Value> aces;
+                Value aces{Document::Document::array()};
                 size_t current_offset = p_security_descriptor->dacl_offset + sizeof(ACL);
 
                 for (int i = 0; i < p_dacl->ace_count; i++)
@@ -176,117 +402,37 @@ namespace ObjectSearch
                         current_offset + p_ace_header->size > value->bv_len)
                         break;
 
-                    std::unique_ptr<JSON::Object> ace_obj = std::make_unique<JSON::Object>();
-                    ace_obj->setValue("type", static_cast<int>(p_ace_header->type));
-                    ace_obj->setValue("flags", static_cast<int>(p_ace_header->flags));
-                    ace_obj->setValue("size", static_cast<int>(p_ace_header->size));
-
-                    if (p_ace_header->type == ACE_Type::ACCESS_ALLOWED_ACE_TYPE ||
-                        p_ace_header->type == ACE_Type::ACCESS_DENIED_ACE_TYPE)
-                    {
-                        if (p_ace_header->size >= sizeof(ACE_Header) + sizeof(uint32_t) + 8)
-                        {
-                            uint32_t *mask_ptr = reinterpret_cast<uint32_t *>(
-                                reinterpret_cast<uint8_t *>(p_ace_header) + sizeof(ACE_Header));
-                            ace_obj->setValue("access_mask", static_cast<int>(*mask_ptr));
-
-                            uint8_t *sid_data{reinterpret_cast<uint8_t *>(p_ace_header) + sizeof(ACE_Header) + sizeof(uint32_t)};
-                            berval sid_berval;
-                            sid_berval.bv_val = reinterpret_cast<char *>(sid_data);
-                            sid_berval.bv_len = p_ace_header->size - sizeof(ACE_Header) - sizeof(uint32_t);
-                            ace_obj->setValue("trustee", parseSid(&sid_berval));
-                        }
-                    }
-                    else if (p_ace_header->type == ACE_Type::ACCESS_ALLOWED_OBJECT_ACE_TYPE ||
-                             p_ace_header->type == ACE_Type::ACCESS_DENIED_OBJECT_ACE_TYPE)
-                    {
-                        if (p_ace_header->size >= sizeof(ACE_Header) + sizeof(uint32_t) + sizeof(uint32_t))
-                        {
-                            uint32_t *mask_ptr = reinterpret_cast<uint32_t *>(
-                                reinterpret_cast<uint8_t *>(p_ace_header) + sizeof(ACE_Header));
-                            uint32_t *flags_ptr = reinterpret_cast<uint32_t *>(
-                                reinterpret_cast<uint8_t *>(p_ace_header) + sizeof(ACE_Header) + sizeof(uint32_t));
-
-                            ace_obj->setValue("access_mask", static_cast<int>(*mask_ptr));
-                            ace_obj->setValue("object_flags", static_cast<int>(*flags_ptr));
-
-                            size_t sid_offset{sizeof(ACE_Header) + sizeof(uint32_t) + sizeof(uint32_t)};
-
-                            if ((*flags_ptr & 0x1) && (sid_offset + 16 <= p_ace_header->size))
-                            {
-                                uint8_t *guid_data{reinterpret_cast<uint8_t *>(p_ace_header) + sid_offset};
-
-                                uint32_t data1{*reinterpret_cast<uint32_t *>(guid_data)};
-                                uint16_t data2{*reinterpret_cast<uint16_t *>(guid_data + 4)};
-                                uint16_t data3{*reinterpret_cast<uint16_t *>(guid_data + 6)};
-
-                                std::ostringstream guid_oss;
-                                guid_oss << std::hex << std::setfill('0')
-                                         << std::setw(8) << data1 << "-"
-                                         << std::setw(4) << data2 << "-"
-                                         << std::setw(4) << data3 << "-";
-
-                                for (int j = 8; j < 10; j++)
-                                    guid_oss << std::setw(2) << static_cast<int>(guid_data[j]);
-
-                                guid_oss << "-";
-
-                                for (int j = 10; j < 16; j++)
-                                    guid_oss << std::setw(2) << static_cast<int>(guid_data[j]);
-
-                                ace_obj->setValue("object_type_guid", guid_oss.str());
-                                sid_offset += 16;
-                            }
-
-                            if ((*flags_ptr & 0x2) && (sid_offset + 16 <= p_ace_header->size))
-                            {
-                                uint8_t *guid_data = reinterpret_cast<uint8_t *>(p_ace_header) + sid_offset;
-
-                                uint32_t data1{*reinterpret_cast<uint32_t *>(guid_data)};
-                                uint16_t data2{*reinterpret_cast<uint16_t *>(guid_data + 4)};
-                                uint16_t data3{*reinterpret_cast<uint16_t *>(guid_data + 6)};
-
-                                std::ostringstream guid_oss;
-                                guid_oss << std::hex << std::setfill('0')
-                                         << std::setw(8) << data1 << "-"
-                                         << std::setw(4) << data2 << "-"
-                                         << std::setw(4) << data3 << "-";
-
-                                for (int j = 8; j < 10; j++)
-                                    guid_oss << std::setw(2) << static_cast<int>(guid_data[j]);
-
-                                guid_oss << "-";
-
-                                for (int j = 10; j < 16; j++)
-                                    guid_oss << std::setw(2) << static_cast<int>(guid_data[j]);
-
-                                ace_obj->setValue("inherited_object_type_guid", guid_oss.str());
-                                sid_offset += 16;
-                            }
-
-                            if (sid_offset + 8 <= p_ace_header->size)
-                            {
-                                uint8_t *sid_data{reinterpret_cast<uint8_t *>(p_ace_header) + sid_offset};
-                                berval sid_berval;
-                                sid_berval.bv_val = reinterpret_cast<char *>(sid_data);
-                                sid_berval.bv_len = p_ace_header->size - sid_offset;
-                                ace_obj->setValue("trustee", parseSid(&sid_berval));
-                            }
-                        }
-                    }
-                    else
-                        ace_obj->setValue("raw_data", 1);
-
-                    aces.push_back(JSON::Value(JSON::ValueType::OBJECT, std::move(ace_obj)));
+                    document.push(aces, parseAce(document, p_ace_header, p_sid_table));
 
                     current_offset += p_ace_header->size;
                 }
 
-                dacl_obj->setValue("aces", aces);
-                result->setValue("dacl", std::move(dacl_obj));
+                dacl = Document::Document::object();
+                document.set(dacl, "ace_count", Document::Document::unsignedInteger(p_dacl->ace_count));
+                document.set(dacl, "aces", aces);
+                document.set(dacl, "revision", Document::Document::unsignedInteger(p_dacl->revision));
+                document.set(dacl, "size", Document::Document::unsignedInteger(p_dacl->acl_size));
             }
         }
 
+        document.set(result, "control", Document::Document::unsignedInteger(p_security_descriptor->control));
+        if (dacl.type != Document::Type::NULL_VALUE)
+            document.set(result, "dacl", dacl);
+        if (group.type != Document::Type::NULL_VALUE)
+            document.set(result, "group", group);
+        if (owner.type != Document::Type::NULL_VALUE)
+            document.set(result, "owner", owner);
+        document.set(result, "revision", Document::Document::unsignedInteger(p_security_descriptor->revision));
+
         return result;
     }
+
+    /* Renders the descriptor straight to writer, built in a per-thread document that is reused */
+    inline void writeSecurityDescriptor(const struct berval *value, SidTable::Interner *p_sid_table, JSON::Writer &writer)
+    {
+        thread_local Document::Document document;
+
+        Document::Document::write(parseSecurityDescriptor(value, document, p_sid_table), writer);
+        document.clear();
+    }
 };
\ No newline at end of file
@@ -0,0 +1,579 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define OUTPUT_HAS_IO_URING 1
+#endif
+
+/*
+    Where JSON::Writer sends what it serialized. A writer hands over its whole buffer
+    (the strings are swapped, nothing is copied) and gets back an empty one kept from
+    an earlier write, so serializing reuses a few large buffers. File writes them on a
+    thread of its own, through io_uring when the kernel offers it and pwrite otherwise,
+    while the dump carries on, and reserves disk space ahead with fallocate.
+*/
+namespace Output
+{
+    //
+    // [SECTION] Sink
+    //
+
+    class Sink
+    {
+    public:
+        virtual ~Sink() = default;
+
+        /* Takes the contents of buffer, which is left empty (but possibly with capacity) */
+        virtual void write(std::string &buffer) = 0;
+
+        /* Runs callback once everything written so far is in the file (on disk for File), possibly on another thread */
+        virtual void whenWritten(std::function<void()> callback) = 0;
+
+        /* Bytes taken so far, where the next write lands */
+        virtual uint64_t size() const = 0;
+
+        /* Drops everything past size once it is written and continues from there, false when the sink cannot go back */
+        virtual bool truncate(uint64_t size)
+        {
+            (void)size;
+            return false;
+        }
+    };
+
+    //
+    // [SECTION] io_uring
+    //
+
+#if defined(OUTPUT_HAS_IO_URING)
+    /* A minimal io_uring over the raw system calls, only ever used for a batch of writes to one file */
+    class Ring
+    {
+    public:
+        static constexpr unsigned ENTRIES{32};
+
+        ~Ring()
+        {
+            if (p_sq_ring != MAP_FAILED && p_sq_ring != nullptr)
+                munmap(p_sq_ring, sq_ring_size);
+            if (p_cq_ring != MAP_FAILED && p_cq_ring != nullptr && p_cq_ring != p_sq_ring)
+                munmap(p_cq_ring, cq_ring_size);
+            if (p_sqes != MAP_FAILED && p_sqes != nullptr)
+                munmap(p_sqes, ENTRIES * sizeof(io_uring_sqe));
+            if (ring_fd >= 0)
+                close(ring_fd);
+        }
+
+        /* False when the kernel (or a sandbox) refuses io_uring */
+        bool open()
+        {
+            io_uring_params params{};
+            ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, ENTRIES, &params));
+            if (ring_fd < 0)
+                return false;
+
+            sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool is_single_mmap{(params.features & IORING_FEAT_SINGLE_MMAP) != 0};
+            if (is_single_mmap)
+                sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+            p_sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+            if (p_sq_ring == MAP_FAILED)
+                return false;
+
+            p_cq_ring = is_single_mmap ? p_sq_ring : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (p_cq_ring == MAP_FAILED)
+                return false;
+
+            p_sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+            if (p_sqes == MAP_FAILED)
+                return false;
+
+            char *p_sq{static_cast<char *>(p_sq_ring)};
+            char *p_cq{static_cast<char *>(p_cq_ring)};
+            p_sq_tail = reinterpret_cast<unsigned *>(p_sq + params.sq_off.tail);
+            p_sq_mask = reinterpret_cast<unsigned *>(p_sq + params.sq_off.ring_mask);
+            p_sq_array = reinterpret_cast<unsigned *>(p_sq + params.sq_off.array);
+            p_cq_head = reinterpret_cast<unsigned *>(p_cq + params.cq_off.head);
+            p_cq_tail = reinterpret_cast<unsigned *>(p_cq + params.cq_off.tail);
+            p_cq_mask = reinterpret_cast<unsigned *>(p_cq + params.cq_off.ring_mask);
+            p_cqes = reinterpret_cast<io_uring_cqe *>(p_cq + params.cq_off.cqes);
+            return true;
+        }
+
+        /*
+            Writes count (at most ENTRIES) buffers at their offsets and waits for all of them,
+            results[i] receiving what write(2) would have returned for buffer i.
+        */
+        bool writeAll(int fd, const std::string *const *p_buffers, const uint64_t *offsets, size_t count, int64_t *results)
+        {
+            unsigned tail{__atomic_load_n(p_sq_tail, __ATOMIC_RELAXED)};
+            io_uring_sqe *p_entries{static_cast<io_uring_sqe *>(p_sqes)};
+
+            for (size_t i{}; i < count; i++)
+            {
+                unsigned index{tail & *p_sq_mask};
+                io_uring_sqe &entry{p_entries[index]};
+                entry = io_uring_sqe{};
+                entry.opcode = IORING_OP_WRITE;
+                entry.fd = fd;
+                entry.off = offsets[i];
+                entry.addr = reinterpret_cast<uint64_t>(p_buffers[i]->data());
+                entry.len = static_cast<uint32_t>(p_buffers[i]->size());
+                entry.user_data = i;
+                p_sq_array[index] = index;
+                tail++;
+            }
+            __atomic_store_n(p_sq_tail, tail, __ATOMIC_RELEASE);
+
+            size_t completed{};
+            size_t submitted{};
+            while (completed < count)
+            {
+                long rc{syscall(__NR_io_uring_enter, ring_fd, static_cast<unsigned>(count - submitted), 1, IORING_ENTER_GETEVENTS, nullptr, 0)};
+                if (rc < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                submitted += static_cast<size_t>(rc);
+
+                unsigned head{__atomic_load_n(p_cq_head, __ATOMIC_RELAXED)};
+                for (; head != __atomic_load_n(p_cq_tail, __ATOMIC_ACQUIRE); head++, completed++)
+                {
+                    const io_uring_cqe &completion{p_cqes[head & *p_cq_mask]};
+                    results[completion.user_data] = completion.res;
+                }
+                __atomic_store_n(p_cq_head, head, __ATOMIC_RELEASE);
+            }
+
+            return true;
+        }
+
+    private:
+        int ring_fd{-1};
+        void *p_sq_ring{};
+        void *p_cq_ring{};
+        void *p_sqes{};
+        size_t sq_ring_size{};
+        size_t cq_ring_size{};
+        unsigned *p_sq_tail{};
+        unsigned *p_sq_mask{};
+        unsigned *p_sq_array{};
+        unsigned *p_cq_head{};
+        unsigned *p_cq_tail{};
+        unsigned *p_cq_mask{};
+        io_uring_cqe *p_cqes{};
+    };
+#endif
+
+    //
+    // [SECTION] File
+    //
+
+    enum class Backend
+    {
+        /* io_uring when available, pwrite otherwise */
+        AUTOMATIC,
+        PWRITE,
+    };
+
+    class File : public Sink
+    {
+    public:
+        /* Writes taken but not yet in the file, past which write() waits */
+        static constexpr uint64_t MAX_PENDING_BYTES{64 << 20};
+        /* Disk space reserved ahead of the end of the file */
+        static constexpr uint64_t PREALLOCATION_STEP{64 << 20};
+
+        ~File()
+        {
+            close();
+        }
+
+        /*
+            Opens path emptied, or cut back to resume_bytes and continued from there when
+            p_resume_bytes is set (false, with a message on stderr, when it is shorter).
+        */
+        bool open(const std::string &path, const uint64_t *p_resume_bytes = nullptr, Backend backend = Backend::AUTOMATIC)
+        {
+            this->path = path;
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (p_resume_bytes == nullptr ? O_TRUNC : 0), 0644);
+            if (fd < 0)
+                return false;
+
+            if (p_resume_bytes != nullptr)
+            {
+                struct stat status{};
+                if (fstat(fd, &status) != 0 || static_cast<uint64_t>(status.st_size) < *p_resume_bytes)
+                {
+                    std::cerr << "[x] " << path << " is shorter than its checkpoint" << std::endl;
+                    ::close(fd);
+                    fd = -1;
+                    return false;
+                }
+
+                if (ftruncate(fd, static_cast<off_t>(*p_resume_bytes)) != 0)
+                {
+                    ::close(fd);
+                    fd = -1;
+                    return false;
+                }
+            }
+
+            taken = written = reserved = p_resume_bytes != nullptr ? *p_resume_bytes : 0;
+            has_failed = false;
+
+#if defined(OUTPUT_HAS_IO_URING)
+            uses_ring = backend == Backend::AUTOMATIC && ring.open();
+#else
+            (void)backend;
+#endif
+
+            is_stopping = false;
+            flusher = std::thread([this]
+                                  { run(); });
+            return true;
+        }
+
+        void write(std::string &buffer) override
+        {
+            if (buffer.empty())
+                return;
+
+            std::unique_lock<std::mutex> lock{mutex};
+            room.wait(lock, [this]
+                      { return pending_bytes < MAX_PENDING_BYTES || has_failed; });
+
+            Item item{};
+            item.offset = taken;
+            taken += buffer.size();
+            pending_bytes += buffer.size();
+
+            /* The writer carries on with a buffer that already has capacity */
+            if (!spare.empty())
+            {
+                item.buffer.swap(spare.back());
+                spare.pop_back();
+            }
+            item.buffer.swap(buffer);
+
+            queue.push_back(std::move(item));
+            work.notify_one();
+        }
+
+        void whenWritten(std::function<void()> callback) override
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            Item item{};
+            item.callback = std::move(callback);
+            queue.push_back(std::move(item));
+            work.notify_one();
+        }
+
+        uint64_t size() const override
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            return taken;
+        }
+
+        /* Waits for every write and callback so far, false when a write failed */
+        bool sync()
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            idle.wait(lock, [this]
+                      { return (queue.empty() && !is_busy) || fd < 0; });
+            return !has_failed;
+        }
+
+        bool truncate(uint64_t size) override
+        {
+            if (!sync())
+                return false;
+
+            std::lock_guard<std::mutex> lock{mutex};
+            if (size > written || ftruncate(fd, static_cast<off_t>(size)) != 0)
+                return false;
+
+            taken = written = size;
+            return true;
+        }
+
+        /* Writes what is left, gives back the space reserved past the end, syncs it to disk and closes, false when a write failed */
+        bool close()
+        {
+            if (fd < 0)
+                return !has_failed;
+
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                is_stopping = true;
+                work.notify_one();
+            }
+            flusher.join();
+
+            if (reserved > written)
+                ftruncate(fd, static_cast<off_t>(written));
+            syncData();
+            ::close(fd);
+            fd = -1;
+
+            return !has_failed;
+        }
+
+        bool usesIoUring() const
+        {
+            return uses_ring;
+        }
+
+        /* Bytes in the file and the time the flushing thread spent writing them */
+        uint64_t writtenBytes() const
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            return written;
+        }
+
+        std::chrono::steady_clock::duration writeTime() const
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            return write_time;
+        }
+
+    private:
+        /* A buffer to write at offset, or a callback when callback is set */
+        struct Item
+        {
+            std::string buffer;
+            uint64_t offset;
+            std::function<void()> callback;
+        };
+
+        std::string path;
+        int fd{-1};
+        std::atomic<bool> uses_ring{false};
+#if defined(OUTPUT_HAS_IO_URING)
+        Ring ring;
+#endif
+        std::thread flusher;
+        std::deque<Item> queue;
+        std::vector<std::string> spare;
+        uint64_t taken{};
+        uint64_t written{};
+        uint64_t reserved{};
+        uint64_t pending_bytes{};
+        std::chrono::steady_clock::duration write_time{};
+        bool is_busy{false};
+        bool is_stopping{false};
+        bool has_failed{false};
+        bool can_preallocate{true};
+        mutable std::mutex mutex;
+        std::condition_variable work;
+        std::condition_variable room;
+        std::condition_variable idle;
+
+        void run()
+        {
+            std::vector<Item> batch;
+
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock{mutex};
+                    work.wait(lock, [this]
+                              { return !queue.empty() || is_stopping; });
+                    if (queue.empty())
+                        return;
+
+                    /* Consecutive writes go out together, a callback ends the batch */
+                    is_busy = true;
+                    while (!queue.empty() && batch.size() < MAX_BATCH)
+                    {
+                        bool is_callback{static_cast<bool>(queue.front().callback)};
+                        if (is_callback && !batch.empty())
+                            break;
+
+                        batch.push_back(std::move(queue.front()));
+                        queue.pop_front();
+                        if (is_callback)
+                            break;
+                    }
+                }
+
+                /* Callbacks journal what is written, so it has to survive a crash first */
+                if (batch.front().callback)
+                {
+                    if (syncData())
+                        batch.front().callback();
+                }
+                else
+                    writeBatch(batch);
+
+                std::lock_guard<std::mutex> lock{mutex};
+                for (Item &item : batch)
+                {
+                    if (item.callback)
+                        continue;
+
+                    pending_bytes -= item.buffer.size();
+                    item.buffer.clear();
+                    spare.push_back(std::move(item.buffer));
+                }
+                batch.clear();
+                is_busy = false;
+
+                room.notify_all();
+                if (queue.empty())
+                    idle.notify_all();
+            }
+        }
+
+#if defined(OUTPUT_HAS_IO_URING)
+        static constexpr size_t MAX_BATCH{Ring::ENTRIES};
+#else
+        static constexpr size_t MAX_BATCH{32};
+#endif
+
+        void writeBatch(const std::vector<Item> &batch)
+        {
+            uint64_t end{batch.back().offset + batch.back().buffer.size()};
+            preallocate(end);
+
+            auto start{std::chrono::steady_clock::now()};
+            bool is_complete{!has_failed};
+
+#if defined(OUTPUT_HAS_IO_URING)
+            if (is_complete && uses_ring)
+            {
+                const std::string *p_buffers[MAX_BATCH];
+                uint64_t offsets[MAX_BATCH];
+                int64_t results[MAX_BATCH];
+                for (size_t i{}; i < batch.size(); i++)
+                {
+                    p_buffers[i] = &batch[i].buffer;
+                    offsets[i] = batch[i].offset;
+                }
+
+                if (ring.writeAll(fd, p_buffers, offsets, batch.size(), results))
+                {
+                    for (size_t i{}; i < batch.size() && is_complete; i++)
+                    {
+                        /* Kernels before 5.6 have the ring but not its write operation */
+                        if (results[i] == -EINVAL || results[i] == -EOPNOTSUPP)
+                        {
+                            uses_ring = false;
+                            results[i] = 0;
+                        }
+                        else if (results[i] < 0)
+                        {
+                            errno = static_cast<int>(-results[i]);
+                            is_complete = false;
+                            break;
+                        }
+
+                        /* Short writes are finished with pwrite */
+                        size_t done{static_cast<size_t>(results[i])};
+                        is_complete = writeAt(batch[i].buffer.data() + done, batch[i].buffer.size() - done, batch[i].offset + done);
+                    }
+                }
+                else
+                {
+                    std::cerr << "[!] io_uring failed (" << strerror(errno) << "), writing " << path << " with pwrite" << std::endl;
+                    uses_ring = false;
+                }
+            }
+            if (is_complete && !uses_ring)
+#else
+            if (is_complete)
+#endif
+            {
+                for (size_t i{}; i < batch.size() && is_complete; i++)
+                    is_complete = writeAt(batch[i].buffer.data(), batch[i].buffer.size(), batch[i].offset);
+            }
+
+            std::lock_guard<std::mutex> lock{mutex};
+            write_time += std::chrono::steady_clock::now() - start;
+            if (is_complete)
+                written = end;
+            else if (!has_failed)
+            {
+                std::cerr << "[x] Failed to write " << path << ": " << strerror(errno) << std::endl;
+                has_failed = true;
+            }
+        }
+
+        /* fdatasync, false when it or an earlier write failed */
+        bool syncData()
+        {
+            if (has_failed)
+                return false;
+
+            if (fdatasync(fd) == 0)
+                return true;
+
+            int error{errno};
+            std::lock_guard<std::mutex> lock{mutex};
+            std::cerr << "[x] Failed to sync " << path << ": " << strerror(error) << std::endl;
+            has_failed = true;
+            return false;
+        }
+
+        bool writeAt(const char *data, size_t size, uint64_t offset)
+        {
+            while (size > 0)
+            {
+                ssize_t count{pwrite(fd, data, size, static_cast<off_t>(offset))};
+                if (count < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+
+                data += count;
+                size -= static_cast<size_t>(count);
+                offset += static_cast<uint64_t>(count);
+            }
+
+            return true;
+        }
+
+        /* Keeps the file size as written, so a checkpoint and a resume never see reserved space */
+        void preallocate(uint64_t end)
+        {
+            if (!can_preallocate || end <= reserved)
+                return;
+
+            uint64_t length{std::max(PREALLOCATION_STEP, end - reserved)};
+            if (fallocate(fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(reserved), static_cast<off_t>(length)) != 0)
+            {
+                /* Not every filesystem supports it (tmpfs before 3.5, NFS, ...) */
+                can_preallocate = false;
+                return;
+            }
+
+            reserved += length;
+        }
+    };
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Pipeline
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* Spins, then yields, then sleeps so idle stages do not burn a core while the network is the bottleneck */
+    struct Backoff
+    {
+        unsigned int attempts{};
+
+        void wait()
+        {
+            if (attempts >= 128)
+                std::this_thread::sleep_for(std::chrono::microseconds(attempts < 256 ? 50 : 500));
+            else if (attempts >= 64)
+                std::this_thread::yield();
+
+            attempts++;
+        }
+    };
+
+    /* Bounded multi-producer/multi-consumer ring (Vyukov), each cell carries a sequence number instead of a lock */
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity)
+        {
+            size_t size{2};
+            while (size < capacity)
+                size <<= 1;
+
+            mask = size - 1;
+            cells = std::make_unique<Cell[]>(size);
+
+            for (size_t i{}; i < size; i++)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        bool tryPush(T &value)
+        {
+            size_t position{enqueue_position.load(std::memory_order_relaxed)};
+
+            for (;;)
+            {
+                Cell &cell{cells[position & mask]};
+                size_t sequence{cell.sequence.load(std::memory_order_acquire)};
+                intptr_t difference{static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position)};
+
+                if (difference == 0)
+                {
+                    if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        cell.value = std::move(value);
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                    return false;
+                else
+                    position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        bool tryPop(T &value)
+        {
+            size_t position{dequeue_position.load(std::memory_order_relaxed)};
+
+            for (;;)
+            {
+                Cell &cell{cells[position & mask]};
+                size_t sequence{cell.sequence.load(std::memory_order_acquire)};
+                intptr_t difference{static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1)};
+
+                if (difference == 0)
+                {
+                    if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        value = std::move(cell.value);
+                        cell.sequence.store(position + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                    return false;
+                else
+                    position = dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        /* Blocks (with backoff) while the queue is full */
+        void push(T value)
+        {
+            Backoff backoff;
+            while (!tryPush(value))
+                backoff.wait();
+        }
+
+        /* Blocks until a value is available, returns false once the queue is closed and drained */
+        bool pop(T &value)
+        {
+            Backoff backoff;
+
+            while (!tryPop(value))
+            {
+                if (closed.load(std::memory_order_acquire))
+                    return tryPop(value);
+
+                backoff.wait();
+            }
+
+            return true;
+        }
+
+        void close()
+        {
+            closed.store(true, std::memory_order_release);
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+        alignas(64) std::atomic<size_t> enqueue_position{0};
+        alignas(64) std::atomic<size_t> dequeue_position{0};
+        std::atomic<bool> closed{false};
+    };
+
+    /*
+        Fans inputs out to a pool of decode workers and hands the results to a single sink
+        thread in submission order. At most `window` inputs are in flight, so submit()
+        blocks when decoding or writing falls behind.
+    */
+    template <typename Input>
+    class Ordered
+    {
+    public:
+        using Decoder = std::function<std::string(Input &)>;
+        using Sink = std::function<void(std::string &)>;
+        using Idle = std::function<void()>;
+        using Mark = std::function<void()>;
+
+        Ordered(size_t worker_count, size_t window, Decoder decoder, Sink sink, Idle idle)
+            : window(window), jobs(window), results(window), decoder(std::move(decoder)), sink(std::move(sink)), idle(std::move(idle))
+        {
+            for (size_t i{}; i < worker_count; i++)
+                workers.emplace_back([this]
+                                     { decode(); });
+
+            writer = std::thread([this]
+                                 { write(); });
+        }
+
+        ~Ordered()
+        {
+            finish();
+        }
+
+        void submit(Input input)
+        {
+            waitForRoom();
+            jobs.push({submitted++, std::move(input), {}});
+        }
+
+        /* Runs mark on the sink thread once every input submitted before it went through the sink */
+        void mark(Mark mark)
+        {
+            waitForRoom();
+            jobs.push({submitted++, Input{}, std::move(mark)});
+        }
+
+        /* Waits for every submitted input to reach the sink */
+        void finish()
+        {
+            if (!writer.joinable())
+                return;
+
+            jobs.close();
+            for (auto &worker : workers)
+                worker.join();
+
+            results.close();
+            writer.join();
+        }
+
+    private:
+        struct Job
+        {
+            uint64_t sequence;
+            Input input;
+            Mark mark;
+        };
+
+        struct Result
+        {
+            uint64_t sequence;
+            std::string output;
+            Mark mark;
+        };
+
+        size_t window;
+        uint64_t submitted{0};
+        std::atomic<uint64_t> written{0};
+        BoundedQueue<Job> jobs;
+        BoundedQueue<Result> results;
+        Decoder decoder;
+        Sink sink;
+        Idle idle;
+        std::vector<std::thread> workers;
+        std::thread writer;
+
+        void waitForRoom()
+        {
+            Backoff backoff;
+            while (submitted - written.load(std::memory_order_acquire) >= window)
+                backoff.wait();
+        }
+
+        void decode()
+        {
+            Job job;
+            while (jobs.pop(job))
+            {
+                if (job.mark)
+                    results.push({job.sequence, {}, std::move(job.mark)});
+                else
+                    results.push({job.sequence, decoder(job.input), {}});
+            }
+        }
+
+        void write()
+        {
+            std::map<uint64_t, Result> pending;
+            uint64_t next{0};
+            bool is_idle{true};
+
+            for (;;)
+            {
+                Result result;
+
+                if (!results.tryPop(result))
+                {
+                    if (!is_idle)
+                    {
+                        idle();
+                        is_idle = true;
+                    }
+
+                    if (!results.pop(result))
+                        break;
+                }
+
+                is_idle = false;
+                uint64_t sequence{result.sequence};
+                pending.emplace(sequence, std::move(result));
+
+                for (auto it{pending.begin()}; it != pending.end() && it->first == next; it = pending.erase(it))
+                {
+                    if (it->second.mark)
+                        it->second.mark();
+                    else
+                        sink(it->second.output);
+                    written.store(++next, std::memory_order_release);
+                }
+            }
+
+            idle();
+        }
+    };
+}
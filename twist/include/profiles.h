@@ -0,0 +1,270 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+#include <strings.h>
+
+#include "object-search.h"
+#include "schemas.h"
+
+/*
+    Which classes and attributes a dump asks for. nTSecurityDescriptor is most of what a
+    DC sends, so analyses that do not need it pick a profile without it, or list their
+    own classes in a file:
+
+        # <CLASS NAME> <objectClass>, then the attributes of that class and their type
+        class GROUPS group
+        attribute member multi_value
+        attribute objectSid sid
+
+    Classes named and shaped like a built-in one keep its compiled decoder, the others
+    are decoded by Schemas::writeRuntimeEntry.
+*/
+namespace Profiles
+{
+    //
+    // [SECTION] Types
+    //
+
+    struct Profile
+    {
+        const char *name;
+        /* Built-in classes dumped, all of them when empty */
+        std::vector<const char *> classes;
+        /* Attributes kept in those classes, all of them when empty */
+        std::vector<const char *> attributes;
+    };
+
+    /* Owns the names read from a class file, the entries built from it point into it */
+    class Names
+    {
+    public:
+        const char *intern(const std::string &name)
+        {
+            strings.push_back(name);
+            return strings.back().c_str();
+        }
+
+    private:
+        /* Never moves its elements */
+        std::deque<std::string> strings;
+    };
+
+    //
+    // [SECTION] Functions
+    //
+
+    inline const std::vector<Profile> &builtIn()
+    {
+        static const std::vector<Profile> PROFILES{
+            {"full", {}, {}},
+            /* Who is a member of what */
+            {"membership", {"USERS", "GROUPS", "COMPUTERS"}, {"distinguishedName", "sAMAccountName", "objectSid", "member", "memberOf"}},
+            /* Who may do what to which object */
+            {"acl", {}, {"distinguishedName", "objectSid", "securityIdentifier", "nTSecurityDescriptor"}},
+        };
+
+        return PROFILES;
+    }
+
+    /* Attribute and class names compare case-insensitively, an empty list holds everything */
+    inline bool contains(const std::vector<const char *> &names, const char *name)
+    {
+        return names.empty() || std::any_of(names.begin(), names.end(), [name](const char *candidate)
+                                            { return strcasecmp(candidate, name) == 0; });
+    }
+
+    /* A built-in class narrowed to the attributes keep(attribute) accepts, decoded by its compiled decoder */
+    template <typename Keep>
+    ObjectSearch::Entry narrow(const ObjectSearch::Entry &schema_entry, Keep &&keep)
+    {
+        ObjectSearch::Entry entry{schema_entry.name, schema_entry.objectClass, {}, schema_entry.writeEntry, 0};
+
+        for (size_t i{}; i < schema_entry.attributes.size(); i++)
+        {
+            if (!keep(schema_entry.attributes[i]))
+                continue;
+
+            entry.attributes.push_back(schema_entry.attributes[i]);
+            entry.schema_mask |= uint64_t{1} << i;
+        }
+
+        return entry;
+    }
+
+    /* entry without its security descriptors, for a first pass leaving them to DescriptorPass */
+    inline ObjectSearch::Entry withoutDescriptors(const ObjectSearch::Entry &entry)
+    {
+        ObjectSearch::Entry light{entry.name, entry.objectClass, {}, entry.writeEntry, entry.schema_mask};
+        uint64_t bits{entry.schema_mask};
+
+        for (const auto &attribute : entry.attributes)
+        {
+            /* Compiled classes list their attributes in schema order, one per bit of the mask */
+            uint64_t bit{bits & (~bits + 1)};
+            bits &= bits - 1;
+
+            if (attribute.type == ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR)
+                light.schema_mask &= ~bit;
+            else
+                light.attributes.push_back(attribute);
+        }
+
+        return light;
+    }
+
+    /* Fills list with the classes of the built-in profile called name */
+    inline bool select(const std::string &name, ObjectSearch::List &list)
+    {
+        const auto &profiles{builtIn()};
+        auto profile{std::find_if(profiles.begin(), profiles.end(), [&name](const Profile &candidate)
+                                  { return name == candidate.name; })};
+
+        if (profile == profiles.end())
+        {
+            std::cerr << "[x] Unknown profile \"" << name << "\", expected full, membership or acl" << std::endl;
+            return false;
+        }
+
+        for (const auto &schema_entry : Schemas::all())
+        {
+            if (!contains(profile->classes, schema_entry.name))
+                continue;
+
+            list.push_back(narrow(schema_entry, [&profile](const ObjectSearch::Attribute &attribute)
+                                  { return contains(profile->attributes, attribute.name); }));
+        }
+
+        return true;
+    }
+
+    inline bool parseType(const std::string &word, ObjectSearch::AttributeType &type)
+    {
+        for (size_t i{}; i < ObjectSearch::ATTRIBUTE_TYPE_COUNT; i++)
+        {
+            if (word == ObjectSearch::ATTRIBUTE_TYPE_NAMES[i])
+            {
+                type = static_cast<ObjectSearch::AttributeType>(i);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /* Class names end up in JSON keys and part file names */
+    inline bool isValidClassName(const std::string &name)
+    {
+        return !name.empty() && std::all_of(name.begin(), name.end(), [](char c)
+                                            { return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-'; });
+    }
+
+    /* Uses the compiled decoder of the built-in class entry matches, when every attribute is one of its own */
+    inline void bindDecoder(ObjectSearch::Entry &entry)
+    {
+        for (const auto &schema_entry : Schemas::all())
+        {
+            if (strcmp(schema_entry.name, entry.name) != 0 || strcasecmp(schema_entry.objectClass, entry.objectClass) != 0)
+                continue;
+
+            bool is_subset{std::all_of(entry.attributes.begin(), entry.attributes.end(), [&schema_entry](const ObjectSearch::Attribute &attribute)
+                                       { return std::any_of(schema_entry.attributes.begin(), schema_entry.attributes.end(), [&attribute](const ObjectSearch::Attribute &candidate)
+                                                            { return strcasecmp(candidate.name, attribute.name) == 0 && candidate.type == attribute.type; }); })};
+
+            if (is_subset)
+            {
+                entry = narrow(schema_entry, [&entry](const ObjectSearch::Attribute &attribute)
+                               { return std::any_of(entry.attributes.begin(), entry.attributes.end(), [&attribute](const ObjectSearch::Attribute &selected)
+                                                    { return strcasecmp(selected.name, attribute.name) == 0; }); });
+                return;
+            }
+        }
+
+        std::sort(entry.attributes.begin(), entry.attributes.end(), [](const ObjectSearch::Attribute &left, const ObjectSearch::Attribute &right)
+                  { return Schemas::nameLess(left.name, right.name); });
+        entry.writeEntry = &Schemas::writeRuntimeEntry;
+        entry.schema_mask = 0;
+    }
+
+    /* Fills list with the classes of the class file at path, their names are kept in names */
+    inline bool load(const std::string &path, Names &names, ObjectSearch::List &list)
+    {
+        std::ifstream input(path);
+        if (!input)
+        {
+            std::cerr << "[x] Failed to read class file " << path << std::endl;
+            return false;
+        }
+
+        auto fail{[&path](size_t line_number, const std::string &message)
+                  {
+                      std::cerr << "[x] " << path << ":" << line_number << ": " << message << std::endl;
+                      return false;
+                  }};
+
+        std::string line;
+        size_t line_number{};
+
+        while (std::getline(input, line))
+        {
+            line_number++;
+
+            std::istringstream fields(line);
+            std::string keyword, name, value, extra;
+            if (!(fields >> keyword) || keyword[0] == '#')
+                continue;
+
+            if (!(fields >> name >> value) || (fields >> extra))
+                return fail(line_number, "expected \"" + keyword + " <name> <" + (keyword == "class" ? "objectClass" : "type") + ">\"");
+
+            if (keyword == "class")
+            {
+                if (!isValidClassName(name))
+                    return fail(line_number, "class names may only hold letters, digits, '_' and '-'");
+                if (std::any_of(list.begin(), list.end(), [&name](const ObjectSearch::Entry &entry)
+                                { return name == entry.name; }))
+                    return fail(line_number, "class " + name + " is listed twice");
+
+                list.push_back({names.intern(name), names.intern(value), {}, nullptr, 0});
+            }
+            else if (keyword == "attribute")
+            {
+                ObjectSearch::AttributeType type{};
+                if (list.empty())
+                    return fail(line_number, "attribute before any class");
+                if (!parseType(value, type))
+                    return fail(line_number, "unknown type \"" + value + "\", expected string, sid, filetime, multi_value, enumeration or security_descriptor");
+
+                list.back().attributes.push_back({names.intern(name), type});
+            }
+            else
+                return fail(line_number, "unknown keyword \"" + keyword + "\", expected class or attribute");
+        }
+
+        if (list.empty())
+        {
+            std::cerr << "[x] " << path << " lists no class" << std::endl;
+            return false;
+        }
+
+        for (auto &entry : list)
+        {
+            if (entry.attributes.empty())
+            {
+                std::cerr << "[x] " << path << ": class " << entry.name << " has no attribute" << std::endl;
+                return false;
+            }
+
+            bindDecoder(entry);
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <charconv>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+
+#include <strings.h>
+
+#include <ldap.h>
+
+#include "connection.h"
+#include "adaptive.h"
+
+/*
+    AD sends at most MaxValRange (1500 by default) values of an attribute with an entry,
+    named "member;range=0-1499", and the rest only to base searches asking for
+    "member;range=1500-*", one range per answer until a range ends in "*". Those follow up
+    searches run on side sessions of their own so they never interleave with the paged
+    search the entry came from, and there are never more of them than the dump has sessions.
+*/
+namespace Ranges
+{
+    //
+    // [SECTION] Functions
+    //
+
+    /*
+        Splits an attribute description such as "member;range=0-1499" into the length of its
+        name and the first value not sent yet (0 once the range ends in "*"), false when it
+        carries no range option.
+    */
+    inline bool parseRange(const char *name, size_t length, size_t &name_length, uint64_t &next)
+    {
+        const char OPTION[]{";range="};
+        const size_t OPTION_LENGTH{sizeof(OPTION) - 1};
+
+        const char *p_end{name + length};
+        const char *p_option{static_cast<const char *>(memchr(name, ';', length))};
+        if (p_option == nullptr || static_cast<size_t>(p_end - p_option) < OPTION_LENGTH || strncasecmp(p_option, OPTION, OPTION_LENGTH) != 0)
+            return false;
+
+        const char *p_dash{static_cast<const char *>(memchr(p_option + OPTION_LENGTH, '-', p_end - p_option - OPTION_LENGTH))};
+        if (p_dash == nullptr)
+            return false;
+
+        name_length = static_cast<size_t>(p_option - name);
+
+        if (p_end - p_dash == 2 && p_dash[1] == '*')
+        {
+            next = 0;
+            return true;
+        }
+
+        uint64_t high{};
+        auto [p_parsed, error]{std::from_chars(p_dash + 1, p_end, high)};
+        if (error != std::errc{} || p_parsed != p_end)
+            return false;
+
+        next = high + 1;
+        return true;
+    }
+
+    //
+    // [SECTION] Fetcher
+    //
+
+    /*
+        Fetches the remaining ranges of attributes, on up to max_sessions sessions opened the
+        first time they are needed. Callers wait for one to come free past that.
+    */
+    class Fetcher
+    {
+    public:
+        Fetcher(const Connection::Settings &settings, size_t max_sessions) : settings(settings), max_sessions(std::max<size_t>(1, max_sessions)) {}
+
+        ~Fetcher()
+        {
+            for (LDAP *p_ldap : idle)
+                ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
+        }
+
+        /*
+            Hands every value of attribute from index from onwards to on_values, one range
+            (a nullptr terminated berval array) at a time as each answer comes in.
+            Returns false when the values could not all be read (errors go to stderr).
+        */
+        template <typename OnValues>
+        bool fetch(const std::string &dn, const char *attribute, uint64_t from, OnValues &&on_values)
+        {
+            LDAP *p_ldap{acquire()};
+            if (p_ldap == nullptr)
+                return false;
+
+            bool is_complete{false};
+            size_t name_length{strlen(attribute)};
+            int attempt{};
+
+            while (true)
+            {
+                std::string request{std::string(attribute) + ";range=" + std::to_string(from) + "-*"};
+                const char *attributes[]{request.c_str(), nullptr};
+                LDAPMessage *p_result{};
+
+                int rc{ldap_search_ext_s(p_ldap, dn.c_str(), LDAP_SCOPE_BASE, "(objectClass=*)", const_cast<char **>(attributes), 0, nullptr, nullptr, nullptr, 0, &p_result)};
+                if (Adaptive::isRefusal(rc) && ++attempt <= Adaptive::MAX_RETRIES)
+                {
+                    if (p_result != nullptr)
+                        ldap_msgfree(p_result);
+                    std::this_thread::sleep_for(std::chrono::seconds(1 << (attempt - 1)));
+                    continue;
+                }
+
+                if (rc != LDAP_SUCCESS)
+                {
+                    std::cerr << "[!] Failed to read " << request << " of \"" << dn << "\": " << ldap_err2string(rc) << std::endl;
+                    if (p_result != nullptr)
+                        ldap_msgfree(p_result);
+                    break;
+                }
+
+                /* The answer names the range it holds, which may be shorter than asked */
+                bool has_range{false};
+                uint64_t next{};
+                LDAPMessage *p_entry{ldap_first_entry(p_ldap, p_result)};
+                BerElement *p_ber{};
+
+                for (char *p_name{p_entry != nullptr ? ldap_first_attribute(p_ldap, p_entry, &p_ber) : nullptr}; p_name != nullptr; p_name = ldap_next_attribute(p_ldap, p_entry, p_ber))
+                {
+                    size_t length{};
+                    if (parseRange(p_name, strlen(p_name), length, next) && length == name_length && strncasecmp(p_name, attribute, length) == 0)
+                    {
+                        berval **values{ldap_get_values_len(p_ldap, p_entry, p_name)};
+                        if (values != nullptr)
+                            on_values(values);
+                        ldap_value_free_len(values);
+                        has_range = true;
+                    }
+
+                    ldap_memfree(p_name);
+                    if (has_range)
+                        break;
+                }
+
+                if (p_ber != nullptr)
+                    ber_free(p_ber, 0);
+                ldap_msgfree(p_result);
+
+                /* No range left means the values were removed since the entry was read */
+                if (!has_range || next == 0)
+                {
+                    is_complete = true;
+                    break;
+                }
+
+                if (next <= from)
+                {
+                    std::cerr << "[!] The server sent " << attribute << " of \"" << dn << "\" out of order, stopping at value " << from << std::endl;
+                    break;
+                }
+
+                from = next;
+                attempt = 0;
+            }
+
+            release(p_ldap);
+            return is_complete;
+        }
+
+    private:
+        Connection::Settings settings;
+        size_t max_sessions;
+        std::vector<LDAP *> idle;
+        /* Sessions idle, in use or being opened */
+        size_t session_count{};
+        std::mutex mutex;
+        std::condition_variable released;
+
+        LDAP *acquire()
+        {
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                released.wait(lock, [this]
+                              { return !idle.empty() || session_count < max_sessions; });
+
+                if (!idle.empty())
+                {
+                    LDAP *p_ldap{idle.back()};
+                    idle.pop_back();
+                    return p_ldap;
+                }
+
+                session_count++;
+            }
+
+            LDAP *p_ldap{Connection::open(settings)};
+            if (p_ldap == nullptr)
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                session_count--;
+                released.notify_one();
+            }
+            return p_ldap;
+        }
+
+        void release(LDAP *p_ldap)
+        {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                idle.push_back(p_ldap);
+            }
+            released.notify_one();
+        }
+    };
+}
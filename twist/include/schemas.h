@@ -0,0 +1,501 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <strings.h>
+
+#include <ldap.h>
+
+#include "object-search.h"
+#include "descriptor-cache.h"
+#include "sid-table.h"
+#include "ranges.h"
+#include "dump.h"
+#include "json.h"
+
+namespace Schemas
+{
+    using ObjectSearch::Attribute;
+    using ObjectSearch::AttributeType;
+
+    //
+    // [SECTION] Object classes
+    //
+
+    struct Users
+    {
+        static constexpr const char *NAME{"USERS"};
+        static constexpr const char *OBJECT_CLASS{"user"};
+        static constexpr Attribute ATTRIBUTES[]{
+            {"sAMAccountName", AttributeType::STRING},
+            {"displayName", AttributeType::STRING},
+            {"distinguishedName", AttributeType::STRING},
+            {"objectSid", AttributeType::BINARY_SID},
+            {"lastLogon", AttributeType::FILETIME},
+            {"memberOf", AttributeType::MULTI_VALUE},
+            {"userAccountControl", AttributeType::ENUMERATION},
+            {"description", AttributeType::STRING},
+            {"nTSecurityDescriptor", AttributeType::BINARY_SECURITY_DESCRIPTOR},
+            {"objectClass", AttributeType::MULTI_VALUE},
+        };
+    };
+
+    struct Groups
+    {
+        static constexpr const char *NAME{"GROUPS"};
+        static constexpr const char *OBJECT_CLASS{"group"};
+        static constexpr Attribute ATTRIBUTES[]{
+            {"sAMAccountName", AttributeType::STRING},
+            {"displayName", AttributeType::STRING},
+            {"objectSid", AttributeType::BINARY_SID},
+            {"description", AttributeType::STRING},
+            {"member", AttributeType::MULTI_VALUE},
+            {"memberOf", AttributeType::MULTI_VALUE},
+            {"nTSecurityDescriptor", AttributeType::BINARY_SECURITY_DESCRIPTOR},
+            {"distinguishedName", AttributeType::STRING},
+        };
+    };
+
+    struct OrganizationalUnits
+    {
+        static constexpr const char *NAME{"ORGANIZATIONAL_UNITS"};
+        static constexpr const char *OBJECT_CLASS{"organizationalUnit"};
+        static constexpr Attribute ATTRIBUTES[]{
+            {"name", AttributeType::STRING},
+            {"distinguishedName", AttributeType::STRING},
+            {"nTSecurityDescriptor", AttributeType::BINARY_SECURITY_DESCRIPTOR},
+            {"gPLink", AttributeType::STRING},
+            {"managedBy", AttributeType::STRING},
+        };
+    };
+
+    struct Computers
+    {
+        static constexpr const char *NAME{"COMPUTERS"};
+        static constexpr const char *OBJECT_CLASS{"computer"};
+        static constexpr Attribute ATTRIBUTES[]{
+            {"sAMAccountName", AttributeType::STRING},
+            {"displayName", AttributeType::STRING},
+            {"distinguishedName", AttributeType::STRING},
+            {"objectSid", AttributeType::BINARY_SID},
+            {"memberOf", AttributeType::MULTI_VALUE},
+            {"userAccountControl", AttributeType::ENUMERATION},
+            {"servicePrincipalName", AttributeType::MULTI_VALUE},
+            {"nTSecurityDescriptor", AttributeType::BINARY_SECURITY_DESCRIPTOR},
+        };
+    };
+
+    struct Domains
+    {
+        static constexpr const char *NAME{"DOMAINS"};
+        static constexpr const char *OBJECT_CLASS{"domainDNS"};
+        static constexpr Attribute ATTRIBUTES[]{
+            {"distinguishedName", AttributeType::STRING},
+            {"objectSid", AttributeType::BINARY_SID},
+            {"nTSecurityDescriptor", AttributeType::BINARY_SECURITY_DESCRIPTOR},
+        };
+    };
+
+    struct Trusts
+    {
+        static constexpr const char *NAME{"TRUSTS"};
+        static constexpr const char *OBJECT_CLASS{"trustedDomain"};
+        static constexpr Attribute ATTRIBUTES[]{
+            {"cn", AttributeType::STRING},
+            {"distinguishedName", AttributeType::STRING},
+            {"securityIdentifier", AttributeType::BINARY_SID},
+            {"trustDirection", AttributeType::ENUMERATION},
+            {"trustType", AttributeType::ENUMERATION},
+            {"trustAttributes", AttributeType::ENUMERATION},
+        };
+    };
+
+    struct Gpos
+    {
+        static constexpr const char *NAME{"GPOS"};
+        static constexpr const char *OBJECT_CLASS{"groupPolicyContainer"};
+        static constexpr Attribute ATTRIBUTES[]{
+            {"displayName", AttributeType::STRING},
+            {"distinguishedName", AttributeType::STRING},
+            {"gPCFileSysPath", AttributeType::STRING},
+            {"nTSecurityDescriptor", AttributeType::BINARY_SECURITY_DESCRIPTOR},
+        };
+    };
+
+    //
+    // [SECTION] Compile-time layout
+    //
+
+    constexpr size_t nameLength(const char *name)
+    {
+        size_t length{};
+        while (name[length] != '\0')
+            length++;
+        return length;
+    }
+
+    /* ASCII case-folded FNV-1a, attribute names are case-insensitive */
+    constexpr uint64_t foldedHash(const char *name, size_t length)
+    {
+        uint64_t hash{0xCBF29CE484222325ULL};
+        for (size_t i{}; i < length; i++)
+            hash = (hash ^ static_cast<unsigned char>(name[i] | 0x20)) * 0x100000001B3ULL;
+        return hash;
+    }
+
+    /* Byte-wise ordering, the key order std::map<std::string> used to give entries */
+    constexpr bool nameLess(const char *left, const char *right)
+    {
+        while (*left != '\0' && *left == *right)
+        {
+            left++;
+            right++;
+        }
+
+        return static_cast<unsigned char>(*left) < static_cast<unsigned char>(*right);
+    }
+
+    template <typename Schema>
+    struct Layout
+    {
+        static constexpr size_t COUNT{std::size(Schema::ATTRIBUTES)};
+        /* Open addressing table, a power of two at least four times the attribute count */
+        static constexpr size_t TABLE_SIZE{64};
+
+        static_assert(COUNT * 4 <= TABLE_SIZE, "Attribute list too long for the lookup table");
+
+        /* Attribute name hash slot -> attribute index, -1 for empty slots */
+        static constexpr std::array<int8_t, TABLE_SIZE> buildSlots()
+        {
+            std::array<int8_t, TABLE_SIZE> slots{};
+            for (auto &slot : slots)
+                slot = -1;
+
+            for (size_t i{}; i < COUNT; i++)
+            {
+                const char *name{Schema::ATTRIBUTES[i].name};
+                size_t slot{foldedHash(name, nameLength(name)) & (TABLE_SIZE - 1)};
+                while (slots[slot] != -1)
+                    slot = (slot + 1) & (TABLE_SIZE - 1);
+
+                slots[slot] = static_cast<int8_t>(i);
+            }
+
+            return slots;
+        }
+
+        /* Attribute indices sorted by name, the order keys are written in */
+        static constexpr std::array<size_t, COUNT> buildOrder()
+        {
+            std::array<size_t, COUNT> order{};
+            for (size_t i{}; i < COUNT; i++)
+                order[i] = i;
+
+            for (size_t i{1}; i < COUNT; i++)
+                for (size_t j{i}; j > 0 && nameLess(Schema::ATTRIBUTES[order[j]].name, Schema::ATTRIBUTES[order[j - 1]].name); j--)
+                {
+                    size_t swapped{order[j]};
+                    order[j] = order[j - 1];
+                    order[j - 1] = swapped;
+                }
+
+            return order;
+        }
+
+        static constexpr std::array<int8_t, TABLE_SIZE> SLOTS{buildSlots()};
+        static constexpr std::array<size_t, COUNT> ORDER{buildOrder()};
+
+        static int find(const char *name, size_t length)
+        {
+            for (size_t slot{foldedHash(name, length) & (TABLE_SIZE - 1)}; SLOTS[slot] != -1; slot = (slot + 1) & (TABLE_SIZE - 1))
+            {
+                const char *candidate{Schema::ATTRIBUTES[SLOTS[slot]].name};
+                if (strncasecmp(candidate, name, length) == 0 && candidate[length] == '\0')
+                    return SLOTS[slot];
+            }
+
+            return -1;
+        }
+    };
+
+    //
+    // [SECTION] Generated decoders
+    //
+
+    /* Values of one attribute, borrowed from the entry's BER */
+    struct Slot
+    {
+        BerVarray values;
+        size_t count;
+        /* Index of the first value AD kept back (see ranges.h), 0 when all of them were sent */
+        uint64_t range_next;
+    };
+
+    /*
+        Writes the values that came with the entry, then streams the ranges still on the server,
+        false when some of them could not be fetched. Behind decode workers an entry is rendered
+        whole before it is appended, so only writers with a sink pass the ranges on as they come.
+    */
+    inline bool writeRanges(const Slot &slot, const char *name, const berval &dn, const Dump::Options &options, JSON::Writer &writer)
+    {
+        writer.beginArray();
+        for (size_t i{}; i < slot.count; i++)
+            writer.value(slot.values[i].bv_val, slot.values[i].bv_len);
+
+        std::string entry_dn(dn.bv_val, dn.bv_len);
+        bool is_complete{true};
+        if (options.p_ranges == nullptr)
+            std::cerr << "[!] Only the first " << slot.count << " values of " << name << " are known for \"" << entry_dn << "\"" << std::endl;
+        else
+            is_complete = options.p_ranges->fetch(entry_dn, name, slot.range_next, [&writer](berval **values)
+                                                  {
+                                                      for (berval **p_value{values}; *p_value != nullptr; p_value++)
+                                                          writer.value((*p_value)->bv_val, (*p_value)->bv_len); });
+
+        writer.endArray();
+        return is_complete;
+    }
+
+    template <AttributeType TYPE>
+    void writeValue(const Slot &slot, const Dump::Options &options, JSON::Writer &writer)
+    {
+        Stats::Timer timer{options.p_stats, TYPE};
+        const berval &first{slot.values[0]};
+
+        if constexpr (TYPE == AttributeType::STRING)
+            writer.value(first.bv_val, first.bv_len);
+        else if constexpr (TYPE == AttributeType::MULTI_VALUE)
+        {
+            writer.beginArray();
+            for (size_t i{}; i < slot.count; i++)
+                writer.value(slot.values[i].bv_val, slot.values[i].bv_len);
+            writer.endArray();
+        }
+        else if constexpr (TYPE == AttributeType::FILETIME)
+        {
+            char buffer[ObjectSearch::FILETIME_BUFFER_SIZE];
+            writer.value(buffer, ObjectSearch::formatFiletime(first.bv_val, first.bv_len, buffer));
+        }
+        else if constexpr (TYPE == AttributeType::BINARY_SID)
+        {
+            if (options.p_sid_table != nullptr)
+            {
+                writer.value(options.p_sid_table->intern(&first));
+                return;
+            }
+
+            char buffer[ObjectSearch::SID_BUFFER_SIZE];
+            size_t length{ObjectSearch::formatSid(reinterpret_cast<const uint8_t *>(first.bv_val), first.bv_len, buffer)};
+            if (length == 0)
+                writer.value("Invalid", 7);
+            else
+                writer.value(buffer, length);
+        }
+        else if constexpr (TYPE == AttributeType::ENUMERATION)
+        {
+            /* Sent as decimal text, signed for flags with the high bit set such as groupType (-2147483646) */
+            int64_t number{};
+            const char *p_end{first.bv_val + first.bv_len};
+            auto [p_parsed, error]{std::from_chars(first.bv_val, p_end, number)};
+            if (error != std::errc{} || p_parsed != p_end)
+            {
+                std::cerr << "[!] \"" << std::string(first.bv_val, first.bv_len) << "\" is not a number, written as text" << std::endl;
+                writer.value(first.bv_val, first.bv_len);
+                return;
+            }
+            writer.value(number);
+        }
+        else if constexpr (TYPE == AttributeType::BINARY_SECURITY_DESCRIPTOR)
+        {
+            if (options.p_descriptor_cache == nullptr)
+                ObjectSearch::writeSecurityDescriptor(&first, options.p_sid_table, writer);
+            else if (options.p_descriptor_cache->usesTable())
+                writer.value(options.p_descriptor_cache->reference(&first));
+            else
+            {
+                std::string rendered{options.p_descriptor_cache->render(&first, writer.depth())};
+                writer.raw(rendered.data(), rendered.size());
+            }
+        }
+    }
+
+    /*
+        Entry decoder generated for one schema: attribute names map to slots through a
+        table built at compile time and each slot is written by a decoder chosen at
+        compile time, in a fixed key order, straight into the writer.
+    */
+    template <typename Schema>
+    struct Decoder
+    {
+        using SchemaLayout = Layout<Schema>;
+
+        static bool writeEntry(BerElement *p_ber, const berval &dn, const ObjectSearch::Entry &class_entry, const Dump::Options &options, JSON::Writer &writer)
+        {
+            Slot slots[SchemaLayout::COUNT]{};
+            uint64_t mask{class_entry.schema_mask};
+
+            bool is_valid{Dump::forEachAttribute(p_ber, [&slots, mask](const berval &name, BerVarray values, size_t count)
+                                                 {
+                /* "member;range=0-1499" fills the member slot */
+                size_t name_length{name.bv_len};
+                uint64_t range_next{};
+                Ranges::parseRange(name.bv_val, name.bv_len, name_length, range_next);
+
+                /* Attributes a profile left out only show up in captures taken without it */
+                int index{SchemaLayout::find(name.bv_val, name_length)};
+                if (index >= 0 && (mask >> index & 1) != 0 && slots[index].values == nullptr)
+                    slots[index] = {values, count, range_next};
+                else if (values != nullptr)
+                    ber_memfree(values); })};
+
+            writer.beginObject();
+            bool is_complete{writeSlots(slots, dn, options, writer, std::make_index_sequence<SchemaLayout::COUNT>{})};
+            writer.endObject();
+
+            for (const Slot &slot : slots)
+                if (slot.values != nullptr)
+                    ber_memfree(slot.values);
+
+            return is_valid && is_complete;
+        }
+
+        /* In key order, every slot is written even when one before it came out incomplete */
+        template <size_t... I>
+        static bool writeSlots(const Slot *slots, const berval &dn, const Dump::Options &options, JSON::Writer &writer, std::index_sequence<I...>)
+        {
+            bool is_complete{true};
+            ((is_complete = writeSlot<SchemaLayout::ORDER[I]>(slots[SchemaLayout::ORDER[I]], dn, options, writer) && is_complete), ...);
+            return is_complete;
+        }
+
+        template <size_t INDEX>
+        static bool writeSlot(const Slot &slot, const berval &dn, const Dump::Options &options, JSON::Writer &writer)
+        {
+            if (slot.values == nullptr || slot.count == 0)
+                return true;
+
+            constexpr Attribute ATTRIBUTE{Schema::ATTRIBUTES[INDEX]};
+            writer.key(ATTRIBUTE.name);
+
+            if constexpr (ATTRIBUTE.type == AttributeType::MULTI_VALUE)
+            {
+                if (slot.range_next != 0)
+                    return writeRanges(slot, ATTRIBUTE.name, dn, options, writer);
+            }
+
+            writeValue<ATTRIBUTE.type>(slot, options, writer);
+            return true;
+        }
+    };
+
+    template <typename Schema>
+    ObjectSearch::Entry describe()
+    {
+        return {
+            Schema::NAME,
+            Schema::OBJECT_CLASS,
+            {std::begin(Schema::ATTRIBUTES), std::end(Schema::ATTRIBUTES)},
+            &Decoder<Schema>::writeEntry,
+            (uint64_t{1} << Layout<Schema>::COUNT) - 1,
+        };
+    }
+
+    //
+    // [SECTION] Runtime decoder
+    //
+
+    /*
+        Decoder for classes only known at runtime (see profiles.h): attribute names are
+        matched by a linear scan over class_entry.attributes, which must be sorted with
+        nameLess as keys are written in that order.
+    */
+    inline bool writeRuntimeEntry(BerElement *p_ber, const berval &dn, const ObjectSearch::Entry &class_entry, const Dump::Options &options, JSON::Writer &writer)
+    {
+        const auto &attributes{class_entry.attributes};
+        std::vector<Slot> slots(attributes.size(), Slot{});
+
+        bool is_valid{Dump::forEachAttribute(p_ber, [&attributes, &slots](const berval &name, BerVarray values, size_t count)
+                                             {
+            size_t name_length{name.bv_len};
+            uint64_t range_next{};
+            Ranges::parseRange(name.bv_val, name.bv_len, name_length, range_next);
+
+            size_t index{};
+            while (index < attributes.size() && !(strncasecmp(attributes[index].name, name.bv_val, name_length) == 0 && attributes[index].name[name_length] == '\0'))
+                index++;
+
+            if (index < attributes.size() && slots[index].values == nullptr)
+                slots[index] = {values, count, range_next};
+            else if (values != nullptr)
+                ber_memfree(values); })};
+
+        bool is_complete{true};
+        writer.beginObject();
+        for (size_t i{}; i < attributes.size(); i++)
+        {
+            const Slot &slot{slots[i]};
+            if (slot.values == nullptr || slot.count == 0)
+                continue;
+
+            writer.key(attributes[i].name);
+
+            switch (attributes[i].type)
+            {
+            case AttributeType::STRING:
+                writeValue<AttributeType::STRING>(slot, options, writer);
+                break;
+            case AttributeType::BINARY_SID:
+                writeValue<AttributeType::BINARY_SID>(slot, options, writer);
+                break;
+            case AttributeType::FILETIME:
+                writeValue<AttributeType::FILETIME>(slot, options, writer);
+                break;
+            case AttributeType::MULTI_VALUE:
+                if (slot.range_next != 0)
+                    is_complete = writeRanges(slot, attributes[i].name, dn, options, writer) && is_complete;
+                else
+                    writeValue<AttributeType::MULTI_VALUE>(slot, options, writer);
+                break;
+            case AttributeType::ENUMERATION:
+                writeValue<AttributeType::ENUMERATION>(slot, options, writer);
+                break;
+            case AttributeType::BINARY_SECURITY_DESCRIPTOR:
+                writeValue<AttributeType::BINARY_SECURITY_DESCRIPTOR>(slot, options, writer);
+                break;
+            }
+        }
+        writer.endObject();
+
+        for (const Slot &slot : slots)
+            if (slot.values != nullptr)
+                ber_memfree(slot.values);
+
+        return is_valid && is_complete;
+    }
+
+    //
+    // [SECTION] Functions
+    //
+
+    /* Every built-in object class, in output order */
+    inline ObjectSearch::List all()
+    {
+        return {
+            describe<Users>(),
+            describe<Groups>(),
+            describe<OrganizationalUnits>(),
+            describe<Computers>(),
+            describe<Domains>(),
+            describe<Trusts>(),
+            describe<Gpos>(),
+        };
+    }
+}
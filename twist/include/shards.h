@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+#include <sys/stat.h>
+
+#include "compression.h"
+#include "output.h"
+#include "stats.h"
+#include "json.h"
+
+/*
+    NDJSON output. Every class is written by a JSON::Writer with the LINES layout, one
+    entry per line, into shard files of its own that are cut at the first line boundary
+    past a size (so a shard only goes over it by the end of one entry). Once the dump is
+    complete manifest.json lists every shard with the entries and bytes it holds, so a
+    loader can read and parse shards in parallel or start on the first one right away.
+    Offsets and sizes are in uncompressed bytes.
+*/
+namespace Shards
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* Bumped whenever the manifest or the shards change in a way loaders have to know about */
+    constexpr int MANIFEST_VERSION{1};
+
+    struct Shard
+    {
+        /* Relative to the directory of the manifest */
+        std::string file;
+        /* Index of its first entry in the class */
+        uint64_t first;
+        uint64_t count;
+        /* Where it starts in the concatenation of the class's shards */
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    //
+    // [SECTION] Class
+    //
+
+    /* The shards of one class, a sink taking whole lines of NDJSON */
+    class Class : public Output::Sink
+    {
+    public:
+        Class(std::string directory, std::string name, uint64_t shard_bytes, const Compression::Settings &compression, Stats::Collector *p_stats)
+            : directory(std::move(directory)), name(std::move(name)), shard_bytes(std::max<uint64_t>(1, shard_bytes)), compression(compression), p_stats(p_stats) {}
+
+        ~Class()
+        {
+            close();
+        }
+
+        void write(std::string &buffer) override
+        {
+            size_t start{};
+
+            while (start < buffer.size() && !has_failed)
+            {
+                /* A shard only ends between two lines, the first one nothing is written to is opened on demand */
+                if (!p_file || (current.bytes >= shard_bytes && !is_mid_line))
+                {
+                    if (!nextShard())
+                        return;
+                }
+
+                /* Up to the size of the shard, then to the end of the line it reached */
+                size_t end{std::min<uint64_t>(buffer.size(), start + (shard_bytes > current.bytes ? shard_bytes - current.bytes : 0))};
+                if (end < buffer.size())
+                {
+                    size_t from{end > start ? end - 1 : start};
+                    const void *p_newline{memchr(buffer.data() + from, '\n', buffer.size() - from)};
+                    end = p_newline != nullptr ? static_cast<size_t>(static_cast<const char *>(p_newline) - buffer.data()) + 1 : buffer.size();
+                }
+
+                current.count += static_cast<uint64_t>(std::count(buffer.begin() + static_cast<std::ptrdiff_t>(start), buffer.begin() + static_cast<std::ptrdiff_t>(end), '\n'));
+                current.bytes += end - start;
+                is_mid_line = buffer[end - 1] != '\n';
+                taken += end - start;
+
+                if (start == 0 && end == buffer.size())
+                    p_stream->write(buffer);
+                else
+                {
+                    std::string piece{buffer, start, end - start};
+                    p_stream->write(piece);
+                }
+
+                start = end;
+            }
+
+            buffer.clear();
+        }
+
+        void whenWritten(std::function<void()> callback) override
+        {
+            if (p_stream)
+                p_stream->whenWritten(std::move(callback));
+            else
+                callback();
+        }
+
+        uint64_t size() const override
+        {
+            return taken;
+        }
+
+        /* Ends the last shard, false when one of them failed */
+        bool close()
+        {
+            closeShard();
+            return !has_failed;
+        }
+
+        const std::string &className() const
+        {
+            return name;
+        }
+
+        const std::vector<Shard> &shardList() const
+        {
+            return shards;
+        }
+
+    private:
+        std::string directory;
+        std::string name;
+        uint64_t shard_bytes;
+        Compression::Settings compression;
+        Stats::Collector *p_stats;
+        std::vector<Shard> shards;
+        Shard current{};
+        std::unique_ptr<Output::File> p_file;
+        std::unique_ptr<Compression::Stream> p_stream;
+        uint64_t taken{};
+        bool is_mid_line{false};
+        bool has_failed{false};
+
+        bool nextShard()
+        {
+            closeShard();
+
+            char index[16];
+            std::snprintf(index, sizeof(index), ".%04zu", shards.size());
+            std::string file{name + index + ".ndjson" + Compression::extension(compression.format)};
+
+            p_file = std::make_unique<Output::File>();
+            if (!p_file->open(directory + "/" + file))
+            {
+                std::cerr << "[x] Failed to open " << directory << "/" << file << std::endl;
+                p_file.reset();
+                has_failed = true;
+                return false;
+            }
+
+            p_stream = std::make_unique<Compression::Stream>(*p_file, compression);
+            current = {file, current.first + current.count, 0, current.offset + current.bytes, 0};
+            return true;
+        }
+
+        void closeShard()
+        {
+            if (!p_file)
+                return;
+
+            bool is_complete{p_stream->close()};
+            is_complete = p_file->close() && is_complete;
+            if (p_stats != nullptr)
+                p_stats->onWrite(p_file->writtenBytes(), p_file->writeTime());
+
+            p_stream.reset();
+            p_file.reset();
+            shards.push_back(current);
+            has_failed = has_failed || !is_complete;
+        }
+    };
+
+    //
+    // [SECTION] Set
+    //
+
+    /* The classes of one dump and their manifest, every class is added before any is written */
+    class Set
+    {
+    public:
+        Set(std::string directory, uint64_t shard_bytes, const Compression::Settings &compression, Stats::Collector *p_stats)
+            : directory(std::move(directory)), shard_bytes(shard_bytes), compression(compression), p_stats(p_stats) {}
+
+        /* Creates the directory when it does not exist yet */
+        bool open()
+        {
+            if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                std::cerr << "[x] Failed to create " << directory << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        Class &add(const std::string &name)
+        {
+            classes.push_back(std::make_unique<Class>(directory, name, shard_bytes, compression, p_stats));
+            return *classes.back();
+        }
+
+        Class *find(const std::string &name)
+        {
+            for (auto &p_class : classes)
+                if (p_class->className() == name)
+                    return p_class.get();
+            return nullptr;
+        }
+
+        /* Writes manifest.json, aside then renamed so a manifest always describes finished shards */
+        bool writeManifest()
+        {
+            std::string path{directory + "/manifest.json"};
+            std::string temporary_path{path + ".tmp"};
+
+            {
+                Output::File output;
+                if (!output.open(temporary_path, nullptr, Output::Backend::PWRITE))
+                    return false;
+
+                JSON::Writer writer{&output};
+                writer.beginObject();
+                writer.key("version");
+                writer.value(MANIFEST_VERSION);
+                writer.key("format");
+                writer.value("ndjson");
+                writer.key("compression");
+                writer.value(compression.format == Compression::Format::GZIP ? "gzip" : compression.format == Compression::Format::ZSTD ? "zstd" : "none");
+                writer.key("shard_bytes");
+                writer.value(shard_bytes);
+
+                writer.key("classes");
+                writer.beginObject();
+                for (const auto &p_class : classes)
+                {
+                    uint64_t count{}, bytes{};
+                    for (const Shard &shard : p_class->shardList())
+                    {
+                        count += shard.count;
+                        bytes += shard.bytes;
+                    }
+
+                    writer.key(p_class->className());
+                    writer.beginObject();
+                    writer.key("count");
+                    writer.value(count);
+                    writer.key("bytes");
+                    writer.value(bytes);
+                    writer.key("shards");
+                    writer.beginArray();
+                    for (const Shard &shard : p_class->shardList())
+                    {
+                        writer.beginObject();
+                        writer.key("file");
+                        writer.value(shard.file);
+                        writer.key("first");
+                        writer.value(shard.first);
+                        writer.key("count");
+                        writer.value(shard.count);
+                        writer.key("offset");
+                        writer.value(shard.offset);
+                        writer.key("bytes");
+                        writer.value(shard.bytes);
+                        writer.endObject();
+                    }
+                    writer.endArray();
+                    writer.endObject();
+                }
+                writer.endObject();
+
+                writer.endObject();
+                writer.flush();
+                if (!output.close())
+                    return false;
+            }
+
+            return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+        }
+
+    private:
+        std::string directory;
+        uint64_t shard_bytes;
+        Compression::Settings compression;
+        Stats::Collector *p_stats;
+        std::vector<std::unique_ptr<Class>> classes;
+    };
+}
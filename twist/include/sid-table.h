@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <ldap.h>
+
+#include "json.h"
+
+namespace ObjectSearch
+{
+    inline std::string parseSid(const struct berval *value);
+}
+
+namespace SidTable
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* Binary SID, at most 15 sub-authorities as in the Windows SID layout */
+    struct Key
+    {
+        uint8_t size;
+        uint8_t bytes[8 + 15 * 4];
+
+        bool operator==(const Key &other) const
+        {
+            return size == other.size && memcmp(bytes, other.bytes, size) == 0;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const
+        {
+            /* FNV-1a, SIDs are short and mostly differ in their last sub-authority */
+            uint64_t hash{0xCBF29CE484222325ULL};
+            for (uint8_t i{}; i < key.size; i++)
+                hash = (hash ^ key.bytes[i]) * 0x100000001B3ULL;
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    /*
+        Stores every SID met during a dump once, in binary form, and hands out its index.
+        writeTable() emits them in index order: SIDs under the most common domain are
+        written as their bare RID, the domain SID itself is written once.
+    */
+    class Interner
+    {
+    public:
+        /* Returns -1 when the bytes are not a valid SID */
+        int intern(const uint8_t *sid, size_t size)
+        {
+            if (size < 8 || sid[0] != 1 || sid[1] > 15)
+                return -1;
+
+            Key key;
+            key.size = static_cast<uint8_t>(8 + sid[1] * 4);
+            if (size < key.size)
+                return -1;
+            memcpy(key.bytes, sid, key.size);
+
+            size_t hash{KeyHash{}(key)};
+            Shard &shard{shards[(hash >> 7) % shards.size()]};
+
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            auto it{shard.indices.find(key)};
+            if (it != shard.indices.end())
+                return it->second;
+
+            std::lock_guard<std::mutex> table_lock{table_mutex};
+            int index{static_cast<int>(table.size())};
+            table.push_back(key);
+            shard.indices.emplace(key, index);
+            return index;
+        }
+
+        int intern(const struct berval *value)
+        {
+            if (value == nullptr || value->bv_val == nullptr)
+                return -1;
+
+            return intern(reinterpret_cast<const uint8_t *>(value->bv_val), value->bv_len);
+        }
+
+        size_t size()
+        {
+            std::lock_guard<std::mutex> table_lock{table_mutex};
+            return table.size();
+        }
+
+        void writeTable(JSON::Writer &writer)
+        {
+            std::lock_guard<std::mutex> table_lock{table_mutex};
+
+            Key domain{findDomain()};
+
+            writer.beginObject();
+
+            writer.key("domain");
+            if (domain.size != 0)
+                writer.value(render(domain));
+            else
+                writer.value("");
+
+            writer.key("entries");
+            writer.beginArray();
+
+            for (const Key &key : table)
+            {
+                uint32_t rid{};
+                if (isUnderDomain(key, domain, rid) && rid <= static_cast<uint32_t>(INT_MAX))
+                    writer.value(static_cast<int>(rid));
+                else
+                    writer.value(render(key));
+            }
+
+            writer.endArray();
+            writer.endObject();
+        }
+
+    private:
+        struct Shard
+        {
+            std::mutex mutex;
+            std::unordered_map<Key, int, KeyHash> indices;
+        };
+
+        std::array<Shard, 32> shards;
+        std::mutex table_mutex;
+        std::deque<Key> table;
+
+        static std::string render(const Key &key)
+        {
+            berval value;
+            value.bv_val = reinterpret_cast<char *>(const_cast<uint8_t *>(key.bytes));
+            value.bv_len = key.size;
+            return ObjectSearch::parseSid(&value);
+        }
+
+        static bool isUnderDomain(const Key &key, const Key &domain, uint32_t &rid)
+        {
+            if (domain.size == 0 || key.size != domain.size + 4 || memcmp(key.bytes + 2, domain.bytes + 2, domain.size - 2) != 0)
+                return false;
+
+            const uint8_t *p_rid{key.bytes + domain.size};
+            rid = p_rid[0] | (p_rid[1] << 8) | (p_rid[2] << 16) | (static_cast<uint32_t>(p_rid[3]) << 24);
+            return true;
+        }
+
+        /* Most frequent S-1-5-21-x-y-z prefix among the interned account SIDs */
+        Key findDomain()
+        {
+            const uint8_t NT_AUTHORITY[6]{0, 0, 0, 0, 0, 5};
+
+            std::unordered_map<Key, size_t, KeyHash> counts;
+            Key best{};
+            size_t best_count{};
+
+            for (const Key &key : table)
+            {
+                if (key.bytes[1] != 5 || memcmp(key.bytes + 2, NT_AUTHORITY, 6) != 0 || key.bytes[8] != 21)
+                    continue;
+
+                Key prefix{};
+                prefix.size = 8 + 4 * 4;
+                memcpy(prefix.bytes, key.bytes, prefix.size);
+                prefix.bytes[1] = 4;
+
+                size_t count{++counts[prefix]};
+                if (count > best_count)
+                {
+                    best = prefix;
+                    best_count = count;
+                }
+            }
+
+            return best;
+        }
+    };
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+
+#include <sys/resource.h>
+
+#include "object-search.h"
+#include "output.h"
+#include "json.h"
+
+/*
+    Counters and timers of a run, written as JSON and/or as a Prometheus textfile. Runs
+    asking for neither pass no collector, and every timer is then a null check. Pages
+    are counted as they complete (a few per thousand entries), decode timings go to a
+    shard owned by the decoding thread so workers never share a cache line, and
+    everything is summed once the run is over.
+*/
+namespace Stats
+{
+    //
+    // [SECTION] Types
+    //
+
+    /* Decode timings are kept per attribute type, the slot after them covers whole entries */
+    constexpr size_t ENTRY_SLOT{ObjectSearch::ATTRIBUTE_TYPE_COUNT};
+    constexpr size_t SLOT_COUNT{ENTRY_SLOT + 1};
+
+    /* Upper bounds of the page latency histogram buckets, in milliseconds (the last one is +Inf) */
+    constexpr uint64_t LATENCY_BOUNDS[]{1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+    constexpr size_t BUCKET_COUNT{std::size(LATENCY_BOUNDS) + 1};
+
+    /* Written by one thread only, read once that thread is done */
+    struct Shard
+    {
+        std::array<std::atomic<uint64_t>, SLOT_COUNT> counts{};
+        std::array<std::atomic<uint64_t>, SLOT_COUNT> nanoseconds{};
+
+        void add(size_t slot, uint64_t elapsed)
+        {
+            counts[slot].store(counts[slot].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            nanoseconds[slot].store(nanoseconds[slot].load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+        }
+    };
+
+    //
+    // [SECTION] Collector
+    //
+
+    class Collector
+    {
+    public:
+        Collector() : start(std::chrono::steady_clock::now()), start_time(std::time(nullptr)) {}
+
+        /* A page of entries (bytes of BER) answered in latency */
+        void onPage(size_t entries, size_t bytes, std::chrono::steady_clock::duration latency)
+        {
+            uint64_t milliseconds{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(latency).count())};
+            size_t bucket{};
+            while (bucket < std::size(LATENCY_BOUNDS) && milliseconds > LATENCY_BOUNDS[bucket])
+                bucket++;
+
+            std::lock_guard<std::mutex> lock{mutex};
+            pages++;
+            total_entries += entries;
+            total_bytes += bytes;
+            latency_sum += latency;
+            latency_buckets[bucket]++;
+        }
+
+        void onRefusal()
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            refusals++;
+        }
+
+        /* A file was closed, with its Output::File::writtenBytes() and Output::File::writeTime() */
+        void onWrite(uint64_t bytes, std::chrono::steady_clock::duration time)
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            written_bytes += bytes;
+            write_time += time;
+        }
+
+        /* The calling thread's shard, created on its first use */
+        Shard &local()
+        {
+            thread_local Collector *p_owner{};
+            thread_local Shard *p_shard{};
+
+            if (p_owner != this)
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                shards.emplace_back();
+                p_shard = &shards.back();
+                p_owner = this;
+            }
+
+            return *p_shard;
+        }
+
+        /* server names what was dumped (its URI, or the capture replayed) */
+        bool writeJson(const std::string &path, const std::string &server)
+        {
+            Totals totals{sum()};
+
+            Output::File output;
+            if (!output.open(path, nullptr, Output::Backend::PWRITE))
+                return false;
+
+            JSON::Writer writer{&output};
+            writer.beginObject();
+            writer.key("server");
+            writer.value(server);
+            writer.key("started");
+            writer.value(static_cast<uint64_t>(start_time));
+            writer.key("duration_seconds");
+            writer.value(totals.seconds);
+            writer.key("peak_rss_bytes");
+            writer.value(peakRss());
+
+            writer.key("fetch");
+            writer.beginObject();
+            writer.key("pages");
+            writer.value(pages);
+            writer.key("entries");
+            writer.value(total_entries);
+            writer.key("bytes");
+            writer.value(total_bytes);
+            writer.key("refused_pages");
+            writer.value(refusals);
+            writer.key("entries_per_second");
+            writer.value(static_cast<double>(total_entries) / totals.seconds);
+            writer.key("mebibytes_per_second");
+            writer.value(static_cast<double>(total_bytes) / totals.seconds / (1 << 20));
+            writer.key("page_latency_ms");
+            writer.beginObject();
+            writer.key("sum");
+            writer.value(std::chrono::duration<double, std::milli>(latency_sum).count());
+            writer.key("buckets");
+            writer.beginArray();
+            for (size_t i{}; i < BUCKET_COUNT; i++)
+            {
+                /* Pages at most le milliseconds long, the last bucket has no bound */
+                writer.beginObject();
+                writer.key("le");
+                if (i < std::size(LATENCY_BOUNDS))
+                    writer.value(LATENCY_BOUNDS[i]);
+                else
+                    writer.raw("null", 4);
+                writer.key("pages");
+                writer.value(latency_buckets[i]);
+                writer.endObject();
+            }
+            writer.endArray();
+            writer.endObject();
+            writer.endObject();
+
+            writer.key("decode");
+            writer.beginObject();
+            for (size_t slot{}; slot < SLOT_COUNT; slot++)
+            {
+                writer.key(slot == ENTRY_SLOT ? "entry" : ObjectSearch::ATTRIBUTE_TYPE_NAMES[slot]);
+                writer.beginObject();
+                writer.key("count");
+                writer.value(totals.counts[slot]);
+                writer.key("nanoseconds");
+                writer.value(totals.nanoseconds[slot]);
+                writer.key("nanoseconds_per_value");
+                writer.value(totals.counts[slot] == 0 ? 0.0 : static_cast<double>(totals.nanoseconds[slot]) / static_cast<double>(totals.counts[slot]));
+                writer.endObject();
+            }
+            writer.endObject();
+
+            writer.key("write");
+            writer.beginObject();
+            writer.key("bytes");
+            writer.value(written_bytes);
+            writer.key("seconds");
+            writer.value(std::chrono::duration<double>(write_time).count());
+            writer.endObject();
+
+            writer.endObject();
+            writer.flush();
+            return output.close();
+        }
+
+        /* Written aside and renamed, as node_exporter's textfile collector expects */
+        bool writePrometheus(const std::string &path, const std::string &server)
+        {
+            Totals totals{sum()};
+            std::string label{"server=\"" + escapeLabel(server) + "\""};
+            std::string temporary_path{path + ".tmp"};
+
+            {
+                std::ofstream output(temporary_path, std::ios::trunc);
+                if (!output)
+                    return false;
+
+                auto metric{[&output](const char *name, const char *type, const char *help)
+                            { output << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n'; }};
+
+                metric("twist_duration_seconds", "gauge", "Wall time of the last dump.");
+                output << "twist_duration_seconds{" << label << "} " << totals.seconds << '\n';
+                metric("twist_peak_rss_bytes", "gauge", "Peak resident set size of the last dump.");
+                output << "twist_peak_rss_bytes{" << label << "} " << peakRss() << '\n';
+                metric("twist_pages_total", "counter", "Pages of search results received.");
+                output << "twist_pages_total{" << label << "} " << pages << '\n';
+                metric("twist_entries_total", "counter", "Entries received.");
+                output << "twist_entries_total{" << label << "} " << total_entries << '\n';
+                metric("twist_received_bytes_total", "counter", "Bytes of BER received.");
+                output << "twist_received_bytes_total{" << label << "} " << total_bytes << '\n';
+                metric("twist_refused_pages_total", "counter", "Pages the server refused (busy, time or admin limits).");
+                output << "twist_refused_pages_total{" << label << "} " << refusals << '\n';
+
+                metric("twist_page_latency_seconds", "histogram", "Time from requesting a page to its last result.");
+                uint64_t cumulative{};
+                for (size_t i{}; i < BUCKET_COUNT; i++)
+                {
+                    cumulative += latency_buckets[i];
+                    output << "twist_page_latency_seconds_bucket{" << label << ",le=\"";
+                    if (i < std::size(LATENCY_BOUNDS))
+                        output << static_cast<double>(LATENCY_BOUNDS[i]) / 1000;
+                    else
+                        output << "+Inf";
+                    output << "\"} " << cumulative << '\n';
+                }
+                output << "twist_page_latency_seconds_sum{" << label << "} " << std::chrono::duration<double>(latency_sum).count() << '\n';
+                output << "twist_page_latency_seconds_count{" << label << "} " << pages << '\n';
+
+                metric("twist_decode_seconds_total", "counter", "Time spent decoding and serializing, per attribute type and per whole entry.");
+                for (size_t slot{}; slot < SLOT_COUNT; slot++)
+                    output << "twist_decode_seconds_total{" << label << ",type=\"" << (slot == ENTRY_SLOT ? "entry" : ObjectSearch::ATTRIBUTE_TYPE_NAMES[slot]) << "\"} "
+                           << static_cast<double>(totals.nanoseconds[slot]) / 1e9 << '\n';
+                metric("twist_decoded_total", "counter", "Attributes and entries decoded, per attribute type and per whole entry.");
+                for (size_t slot{}; slot < SLOT_COUNT; slot++)
+                    output << "twist_decoded_total{" << label << ",type=\"" << (slot == ENTRY_SLOT ? "entry" : ObjectSearch::ATTRIBUTE_TYPE_NAMES[slot]) << "\"} " << totals.counts[slot] << '\n';
+
+                metric("twist_written_bytes_total", "counter", "Bytes of JSON written.");
+                output << "twist_written_bytes_total{" << label << "} " << written_bytes << '\n';
+                metric("twist_write_seconds_total", "counter", "Time spent writing JSON to disk.");
+                output << "twist_write_seconds_total{" << label << "} " << std::chrono::duration<double>(write_time).count() << '\n';
+
+                if (!output.flush())
+                    return false;
+            }
+
+            return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+        }
+
+    private:
+        struct Totals
+        {
+            double seconds;
+            std::array<uint64_t, SLOT_COUNT> counts;
+            std::array<uint64_t, SLOT_COUNT> nanoseconds;
+        };
+
+        std::chrono::steady_clock::time_point start;
+        std::time_t start_time;
+        uint64_t pages{};
+        uint64_t total_entries{};
+        uint64_t total_bytes{};
+        uint64_t refusals{};
+        std::chrono::steady_clock::duration latency_sum{};
+        std::array<uint64_t, BUCKET_COUNT> latency_buckets{};
+        uint64_t written_bytes{};
+        std::chrono::steady_clock::duration write_time{};
+        /* Never moves its elements, threads keep pointers to their shard */
+        std::deque<Shard> shards;
+        std::mutex mutex;
+
+        Totals sum()
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            Totals totals{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), {}, {}};
+
+            for (const Shard &shard : shards)
+            {
+                for (size_t slot{}; slot < SLOT_COUNT; slot++)
+                {
+                    totals.counts[slot] += shard.counts[slot].load(std::memory_order_relaxed);
+                    totals.nanoseconds[slot] += shard.nanoseconds[slot].load(std::memory_order_relaxed);
+                }
+            }
+
+            return totals;
+        }
+
+        static uint64_t peakRss()
+        {
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            /* ru_maxrss is in KiB on Linux */
+            return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+        }
+
+        static std::string escapeLabel(const std::string &value)
+        {
+            std::string output;
+            for (char c : value)
+            {
+                if (c == '\\' || c == '"')
+                    output += '\\';
+                if (c == '\n')
+                    output += "\\n";
+                else
+                    output += c;
+            }
+            return output;
+        }
+    };
+
+    //
+    // [SECTION] Timer
+    //
+
+    /* Adds the time until it goes out of scope to a slot of the calling thread's shard, does nothing without a collector */
+    class Timer
+    {
+    public:
+        Timer(Collector *p_collector, size_t slot) : p_collector(p_collector), slot(slot)
+        {
+            if (p_collector != nullptr)
+                start = std::chrono::steady_clock::now();
+        }
+
+        Timer(Collector *p_collector, ObjectSearch::AttributeType type) : Timer(p_collector, static_cast<size_t>(type)) {}
+
+        ~Timer()
+        {
+            if (p_collector != nullptr)
+                p_collector->local().add(slot, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+    private:
+        Collector *p_collector;
+        size_t slot;
+        std::chrono::steady_clock::time_point start;
+    };
+}
@@ -2,35 +2,15 @@
 
 #include <string>
 
+#include "escape.h"
+
 namespace Utils
 {
-    std::string escapeJson(const std::string &input)
+    inline std::string escapeJson(const std::string &input)
     {
         std::string output;
-        for (char c : input)
-        {
-            switch (c)
-            {
-            case '"':
-                output += "\\\"";
-                break;
-            case '\\':
-                output += "\\\\";
-                break;
-            case '\n':
-                output += "\\n";
-                break;
-            case '\r':
-                output += "\\r";
-                break;
-            case '\t':
-                output += "\\t";
-                break;
-            default:
-                output += c;
-                break;
-            }
-        }
+        output.reserve(input.size());
+        Escape::append(input.data(), input.size(), output);
         return output;
     }
 }
\ No newline at end of file
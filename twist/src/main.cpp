@@ -3,54 +3,64 @@
 #include <sstream>
 #include <vector>
 #include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <functional>
 
 #include <ldap.h>
 
 #include "arguments.h"
+#include "connection.h"
+#include "capture.h"
+#include "incremental.h"
+#include "checkpoint.h"
+#include "adaptive.h"
+#include "ranges.h"
+#include "profiles.h"
+#include "stats.h"
+#include "compression.h"
+#include "shards.h"
+#include "descriptor-pass.h"
+#include "descriptor-cache.h"
+#include "sid-table.h"
+#include "dump.h"
 #include "object-search.h"
+#include "schemas.h"
 #include "utils.h"
 #include "json.h"
 
-LDAPControl *createSDFlagsControl()
-{
-    BerElement *ber{ber_alloc_t(LBER_USE_DER)};
-    if (!ber)
-        return nullptr;
-
-    if (ber_printf(ber, "{i}", 7) == -1)
-    {
-        ber_free(ber, 1);
-        return nullptr;
-    }
-
-    berval *encodedValue{};
-    if (ber_flatten(ber, &encodedValue) == -1)
-    {
-        ber_free(ber, 1);
-        return nullptr;
-    }
-
-    LDAPControl *control{new LDAPControl};
-    control->ldctl_oid = const_cast<char *>("1.2.840.113556.1.4.801");
-    control->ldctl_iscritical = 0;
-    control->ldctl_value.bv_len = encodedValue->bv_len;
-    control->ldctl_value.bv_val = new char[encodedValue->bv_len];
-    memcpy(control->ldctl_value.bv_val, encodedValue->bv_val, encodedValue->bv_len);
-
-    ber_bvfree(encodedValue);
-    ber_free(ber, 1);
-    return control;
-}
-
 int main(int argc, char **argv)
 {
     Arguments::Map arguments = {
-        {"-u", {Arguments::Type::STRING, true, std::nullopt}},
-        {"-p", {Arguments::Type::STRING, true, std::nullopt}},
-        {"-d", {Arguments::Type::STRING, true, std::nullopt}},
-        {"-h", {Arguments::Type::STRING, true, std::nullopt}},
+        /* -u, -p, -d and -h are required unless replaying */
+        {"-u", {Arguments::Type::STRING, false, std::nullopt}},
+        {"-p", {Arguments::Type::STRING, false, std::nullopt}},
+        {"-d", {Arguments::Type::STRING, false, std::nullopt}},
+        {"-h", {Arguments::Type::STRING, false, std::nullopt}},
         {"-s", {Arguments::Type::BOOLEAN, false, false}},
         {"-sp", {Arguments::Type::INT, false, 389}},
+        {"-b", {Arguments::Type::STRING, false, std::nullopt}},
+        {"-c", {Arguments::Type::INT, false, 1}},
+        {"-w", {Arguments::Type::INT, false, std::nullopt}},
+        {"-sdt", {Arguments::Type::BOOLEAN, false, false}},
+        {"-sit", {Arguments::Type::BOOLEAN, false, false}},
+        {"--record", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--replay", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--incremental", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--resume", {Arguments::Type::BOOLEAN, false, false}},
+        {"-ps", {Arguments::Type::INT, false, std::nullopt}},
+        {"--profile", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--classes", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--lazy-descriptors", {Arguments::Type::BOOLEAN, false, false}},
+        {"--stats", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--prometheus", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--compress", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--compress-level", {Arguments::Type::INT, false, -1}},
+        {"--ndjson", {Arguments::Type::STRING, false, std::nullopt}},
+        {"--shard-size", {Arguments::Type::INT, false, 64}},
     };
 
     int return_code{Arguments::parse(argc, argv, arguments)};
@@ -61,350 +71,464 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    auto username{Arguments::getValue<std::string>(arguments, "-u")};
-    auto password{Arguments::getValue<std::string>(arguments, "-p")};
-    auto domain{Arguments::getValue<std::string>(arguments, "-d")};
-    auto host{Arguments::getValue<std::string>(arguments, "-h")};
-    auto use_secure{Arguments::getValue<int>(arguments, "-s").value_or(0) != 0};
+    auto record_path{Arguments::getValue<std::string>(arguments, "--record")};
+    auto replay_path{Arguments::getValue<std::string>(arguments, "--replay")};
 
-    int port{};
-    auto &port_argument{arguments["-sp"]};
-    if (port_argument.was_specified)
-        port = std::get<int>(*port_argument.value);
-    else
-        port = use_secure ? 636 : 389;
+    auto snapshot_path{Arguments::getValue<std::string>(arguments, "--incremental")};
 
-    bool is_ldaps = use_secure && (port == 636);
-    bool is_start_tls = use_secure && (port != 636);
+    if ((record_path ? 1 : 0) + (replay_path ? 1 : 0) + (snapshot_path ? 1 : 0) > 1)
+    {
+        std::cerr << "[x] --record, --replay and --incremental are exclusive" << std::endl;
+        return 1;
+    }
 
-    LDAP *p_ldap;
-    std::string uri((is_ldaps ? "ldaps://" : "ldap://") + *host + ":" + std::to_string(port));
-    return_code = ldap_initialize(&p_ldap, uri.c_str());
+    Connection::Settings settings{};
+    std::string base_dn;
 
-    if (return_code != LDAP_SUCCESS)
+    if (!replay_path)
     {
-        std::cerr << "[x] Failed to initialize LDAP: " << ldap_err2string(return_code) << std::endl;
-        return 1;
+        for (const char *key : {"-u", "-p", "-d", "-h"})
+        {
+            if (!arguments[key].value)
+            {
+                std::cerr << "[x] Required argument \"" << key << "\"'s value is missing" << std::endl;
+                return 1;
+            }
+        }
+
+        auto username{Arguments::getValue<std::string>(arguments, "-u")};
+        auto password{Arguments::getValue<std::string>(arguments, "-p")};
+        auto domain{Arguments::getValue<std::string>(arguments, "-d")};
+        auto host{Arguments::getValue<std::string>(arguments, "-h")};
+        auto use_secure{Arguments::getValue<int>(arguments, "-s").value_or(0) != 0};
+
+        int port{};
+        auto &port_argument{arguments["-sp"]};
+        if (port_argument.was_specified)
+            port = std::get<int>(*port_argument.value);
+        else
+            port = use_secure ? 636 : 389;
+
+        bool is_ldaps = use_secure && (port == 636);
+        bool is_start_tls = use_secure && (port != 636);
+
+        size_t domain_short_end{domain->find('.')};
+        std::string domain_short{domain->substr(0, domain_short_end)};
+        std::string domain_ext{domain->substr(domain_short_end + 1, domain->length() - domain_short_end - 1)};
+        /* Non-AD servers (the benchmark slapd) only accept a plain DN */
+        std::string bind_dn{Arguments::getValue<std::string>(arguments, "-b").value_or(domain_short + "\\" + *username)};
+
+        settings = {
+            (is_ldaps ? "ldaps://" : "ldap://") + *host + ":" + std::to_string(port),
+            bind_dn,
+            *password,
+            is_ldaps,
+            is_start_tls,
+        };
+
+        base_dn = "DC=" + domain_short + ",DC=" + domain_ext;
     }
 
-    int version = LDAP_VERSION3;
+    auto profile{Arguments::getValue<std::string>(arguments, "--profile")};
+    auto classes_path{Arguments::getValue<std::string>(arguments, "--classes")};
 
-    return_code = ldap_set_option(p_ldap, LDAP_OPT_PROTOCOL_VERSION, &version);
-    if (return_code != LDAP_OPT_SUCCESS)
+    if (profile && classes_path)
     {
-        std::cerr << "[x] Failed to set LDAP version: " << ldap_err2string(return_code) << std::endl;
-        ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
+        std::cerr << "[x] --profile and --classes are exclusive" << std::endl;
         return 1;
     }
 
-    return_code = ldap_set_option(p_ldap, LDAP_OPT_REFERRALS, LDAP_OPT_OFF);
-    if (return_code != LDAP_OPT_SUCCESS)
-        std::cout << "[!] Could not disable referrals" << std::endl;
+    /* Which classes and attributes are dumped, every built-in one unless narrowed */
+    Profiles::Names class_names;
+    ObjectSearch::List objectSearches;
+    if (classes_path ? !Profiles::load(*classes_path, class_names, objectSearches) : !Profiles::select(profile.value_or("full"), objectSearches))
+        return 1;
 
-    struct timeval timeout;
-    timeout.tv_sec = 30;
-    timeout.tv_usec = 0;
-    return_code = ldap_set_option(p_ldap, LDAP_OPT_NETWORK_TIMEOUT, &timeout);
-    if (return_code != LDAP_OPT_SUCCESS)
-        std::cout << "[!] Could not set network timeout" << std::endl;
+    /* Descriptors are left out of output.json and fetched once it is written, see descriptor-pass.h */
+    bool is_lazy{Arguments::getValue<int>(arguments, "--lazy-descriptors").value_or(0) != 0};
+    ObjectSearch::List descriptor_searches;
 
-    if (is_ldaps || is_start_tls)
+    if (is_lazy)
     {
-        int tls_req = LDAP_OPT_X_TLS_NEVER;
-        ldap_set_option(p_ldap, LDAP_OPT_X_TLS_REQUIRE_CERT, &tls_req);
+        if (replay_path || record_path || snapshot_path || Arguments::getValue<int>(arguments, "-sdt").value_or(0) != 0 || Arguments::getValue<int>(arguments, "-sit").value_or(0) != 0)
+        {
+            std::cerr << "[x] --lazy-descriptors cannot be combined with -sdt, -sit, --record, --replay or --incremental" << std::endl;
+            return 1;
+        }
 
-        int tls_protocol = LDAP_OPT_X_TLS_PROTOCOL_TLS1_2;
-        ldap_set_option(p_ldap, LDAP_OPT_X_TLS_PROTOCOL_MIN, &tls_protocol);
+        descriptor_searches = objectSearches;
+        ObjectSearch::List light_searches;
+        for (const auto &entry : objectSearches)
+        {
+            ObjectSearch::Entry light{Profiles::withoutDescriptors(entry)};
+            /* An empty attribute list would ask for every attribute */
+            if (!light.attributes.empty())
+                light_searches.push_back(light);
+        }
+        objectSearches = light_searches;
     }
 
-    if (is_start_tls)
+    int connection_count{std::max(1, Arguments::getValue<int>(arguments, "-c").value_or(1))};
+
+    /* Decode workers per class search, spread the cores over the concurrent searches by default */
+    int hardware_threads{std::max(1, static_cast<int>(std::thread::hardware_concurrency()))};
+    size_t decode_workers{static_cast<size_t>(std::max(0, Arguments::getValue<int>(arguments, "-w").value_or(std::max(1, hardware_threads / connection_count))))};
+
+    /* Output files are compressed block-wise on a pool of their own, taking every core as blocks are independent */
+    Compression::Settings compression{};
+    compression.worker_count = static_cast<size_t>(hardware_threads);
+    auto compression_name{Arguments::getValue<std::string>(arguments, "--compress")};
+    if (compression_name && !Compression::parse(*compression_name, Arguments::getValue<int>(arguments, "--compress-level").value_or(-1), compression))
+        return 1;
+
+    std::string output_path{std::string("output.json") + Compression::extension(compression.format)};
+
+    bool use_sid_table{Arguments::getValue<int>(arguments, "-sit").value_or(0) != 0};
+
+    /* Every class is written to NDJSON shards of its own instead of output.json, see shards.h */
+    auto shards_directory{Arguments::getValue<std::string>(arguments, "--ndjson")};
+    if (shards_directory && (is_lazy || use_sid_table || Arguments::getValue<int>(arguments, "-sdt").value_or(0) != 0))
     {
-        return_code = ldap_start_tls_s(p_ldap, nullptr, nullptr);
-        if (return_code != LDAP_SUCCESS)
-        {
-            std::cerr << "[x] Failed to start TLS: " << ldap_err2string(return_code) << std::endl;
-            ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
-            return 1;
-        }
+        std::cerr << "[x] --ndjson cannot be combined with -sdt, -sit or --lazy-descriptors" << std::endl;
+        return 1;
     }
+    SidTable::Interner sid_table;
+    SidTable::Interner *p_sid_table{use_sid_table ? &sid_table : nullptr};
 
-    size_t domain_short_end{domain->find('.')};
-    std::string domain_short{domain->substr(0, domain_short_end)};
-    std::string domain_ext{domain->substr(domain_short_end + 1, domain->length() - domain_short_end - 1)};
-    std::string bind_dn{domain_short + "\\" + *username};
+    DescriptorCache::Cache descriptor_cache{Arguments::getValue<int>(arguments, "-sdt").value_or(0) != 0, p_sid_table};
+    Capture::Recorder recorder;
+    if (record_path && !recorder.open(*record_path))
+    {
+        std::cerr << "[x] Failed to open capture file " << *record_path << std::endl;
+        return 1;
+    }
 
-    return_code = ldap_simple_bind_s(p_ldap, bind_dn.c_str(), password->c_str());
+    /*
+        Only plain dumps are journaled: the SID and descriptor tables live in memory and captures have their own files.
+        A compressed output.json cannot be cut back to a checkpoint, parallel dumps journal their uncompressed parts.
+    */
+    bool is_compressed_stream{compression.format != Compression::Format::NONE && connection_count == 1};
+    bool use_journal{!use_sid_table && !descriptor_cache.usesTable() && !record_path && !replay_path && !snapshot_path && !is_compressed_stream && !shards_directory};
+    bool is_resuming{Arguments::getValue<int>(arguments, "--resume").value_or(0) != 0};
 
-    if (return_code != LDAP_SUCCESS)
+    if (is_resuming && !use_journal)
     {
-        std::cerr << "[x] Failed to bind LDAP: " << ldap_err2string(return_code) << std::endl;
-        ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
+        std::cerr << "[x] --resume cannot be combined with -sdt, -sit, --record, --replay, --incremental, --ndjson or (with a single connection) --compress" << std::endl;
         return 1;
     }
 
-    std::string base_dn("DC=" + domain_short + ",DC=" + domain_ext);
+    /* A checkpoint only fits a run writing the same classes to the same files */
+    std::string layout{std::string(connection_count == 1 ? "output" : "parts") + (classes_path ? " classes " + *classes_path : " profile " + profile.value_or("full")) + (is_lazy ? " lazy" : "")};
 
-    ObjectSearch::Map objectSearchMap = {
-        {
-            "USERS",
-            {
-                "user",
-                {
-                    {"sAMAccountName", ObjectSearch::AttributeType::STRING},
-                    {"displayName", ObjectSearch::AttributeType::STRING},
-                    {"distinguishedName", ObjectSearch::AttributeType::STRING},
-                    {"objectSid", ObjectSearch::AttributeType::BINARY_SID},
-                    {"lastLogon", ObjectSearch::AttributeType::FILETIME},
-                    {"memberOf", ObjectSearch::AttributeType::MULTI_VALUE},
-                    {"userAccountControl", ObjectSearch::AttributeType::ENUMERATION},
-                    {"description", ObjectSearch::AttributeType::STRING},
-                    {"nTSecurityDescriptor", ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR},
-                    {"objectClass", ObjectSearch::AttributeType::MULTI_VALUE},
-                },
-            },
-        },
-        {
-            "GROUPS",
-            {
-                "group",
-                {
-                    {"sAMAccountName", ObjectSearch::AttributeType::STRING},
-                    {"displayName", ObjectSearch::AttributeType::STRING},
-                    {"objectSid", ObjectSearch::AttributeType::BINARY_SID},
-                    {"description", ObjectSearch::AttributeType::STRING},
-                    {"member", ObjectSearch::AttributeType::MULTI_VALUE},
-                    {"memberOf", ObjectSearch::AttributeType::MULTI_VALUE},
-                    {"nTSecurityDescriptor", ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR},
-                    {"distinguishedName", ObjectSearch::AttributeType::STRING},
-                },
-            },
-        },
-        {
-            "ORGANIZATIONAL_UNITS",
-            {
-                "organizationalUnit",
-                {
-                    {"name", ObjectSearch::AttributeType::STRING},
-                    {"distinguishedName", ObjectSearch::AttributeType::STRING},
-                    {"nTSecurityDescriptor", ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR},
-                    {"gPLink", ObjectSearch::AttributeType::STRING},
-                    {"managedBy", ObjectSearch::AttributeType::STRING},
-                },
-            },
-        },
-        {
-            "COMPUTERS",
-            {
-                "computer",
-                {
-                    {"sAMAccountName", ObjectSearch::AttributeType::STRING},
-                    {"displayName", ObjectSearch::AttributeType::STRING},
-                    {"distinguishedName", ObjectSearch::AttributeType::STRING},
-                    {"objectSid", ObjectSearch::AttributeType::BINARY_SID},
-                    {"memberOf", ObjectSearch::AttributeType::MULTI_VALUE},
-                    {"userAccountControl", ObjectSearch::AttributeType::ENUMERATION},
-                    {"servicePrincipalName", ObjectSearch::AttributeType::MULTI_VALUE},
-                    {"nTSecurityDescriptor", ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR},
-                },
-            },
-        },
-        {
-            "DOMAINS",
-            {
-                "domainDNS",
-                {
-                    {"distinguishedName", ObjectSearch::AttributeType::STRING},
-                    {"objectSid", ObjectSearch::AttributeType::BINARY_SID},
-                    {"nTSecurityDescriptor", ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR},
-                },
-            },
-        },
-        {
-            "TRUSTS",
-            {
-                "trustedDomain",
-                {
-                    {"cn", ObjectSearch::AttributeType::STRING},
-                    {"distinguishedName", ObjectSearch::AttributeType::STRING},
-                    {"securityIdentifier", ObjectSearch::AttributeType::BINARY_SID},
-                    {"trustDirection", ObjectSearch::AttributeType::ENUMERATION},
-                    {"trustType", ObjectSearch::AttributeType::ENUMERATION},
-                    {"trustAttributes", ObjectSearch::AttributeType::ENUMERATION},
-                },
-            },
-        },
-        {
-            "GPOS",
-            {
-                "groupPolicyContainer",
-                {
-                    {"displayName", ObjectSearch::AttributeType::STRING},
-                    {"distinguishedName", ObjectSearch::AttributeType::STRING},
-                    {"gPCFileSysPath", ObjectSearch::AttributeType::STRING},
-                    {"nTSecurityDescriptor", ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR},
-                },
-            },
-        },
-    };
+    Checkpoint::Journal journal;
+    if (use_journal && !journal.open("output.json.checkpoint", layout, is_resuming))
+        return 1;
 
-    std::unique_ptr<JSON::Object> root_json_object{std::make_unique<JSON::Object>()};
+    Connection::Pool pool;
+    if (!replay_path && !pool.open(settings, connection_count))
+        return 1;
 
-    for (auto &entry : objectSearchMap)
-    {
-        std::string filter{"(objectClass=" + std::string(entry.second.objectClass) + ")"};
+    /* Written to --stats and --prometheus once the dump is complete, nothing is timed without either */
+    auto stats_path{Arguments::getValue<std::string>(arguments, "--stats")};
+    auto prometheus_path{Arguments::getValue<std::string>(arguments, "--prometheus")};
+    Stats::Collector stats;
+    Stats::Collector *p_stats{stats_path || prometheus_path ? &stats : nullptr};
 
-        std::vector<JSON::Value> objects_array;
+    /* Page size adapts unless -ps fixes it, concurrent searches adapt up to -c */
+    Adaptive::Controller controller{Arguments::getValue<int>(arguments, "-ps").value_or(0), &pool, p_stats};
 
-        std::vector<const char *> attributes;
-        for (const auto &attribute : entry.second.attributes)
-            attributes.push_back(attribute.name);
-        attributes.push_back(nullptr);
+    /* Values AD holds back are fetched on side sessions (as many as -c at most), a replay only has what was captured */
+    Ranges::Fetcher ranges{settings, static_cast<size_t>(connection_count)};
 
-        struct berval *cookie = nullptr;
-        int page_size = 500;
+    Dump::Options options{decode_workers, &descriptor_cache, p_sid_table, record_path ? &recorder : nullptr, use_journal ? &journal : nullptr, &controller, replay_path ? nullptr : &ranges, p_stats};
 
-        do
+    /* An incremental run refreshes its snapshot, then the output is rendered from it like a replay */
+    if (snapshot_path)
+    {
+        if (!Incremental::update(pool, base_dn, objectSearches, controller, *snapshot_path))
+            return 1;
+        controller.report();
+        replay_path = snapshot_path;
+    }
+
+    Capture::Reader reader;
+    if (replay_path && !reader.open(*replay_path))
+    {
+        std::cerr << "[x] Failed to read capture file " << *replay_path << std::endl;
+        return 1;
+    }
+
+    /* A single connection writes output.json in class order, so it continues after the last class journaled */
+    Checkpoint::Progress resume_point{};
+    bool has_resume_point{false};
+    if (is_resuming && connection_count == 1)
+    {
+        for (auto &entry : objectSearches)
         {
-            LDAPMessage *search_result = nullptr;
-            LDAPControl *sdControl = createSDFlagsControl();
-            LDAPControl *pageControl = nullptr;
-            struct berval null_cookie = {0, nullptr};
-            struct berval *current_cookie = cookie ? cookie : &null_cookie;
-
-            int rc = ldap_create_page_control(p_ldap, page_size, current_cookie, 0, &pageControl);
-            if (rc != LDAP_SUCCESS)
+            Checkpoint::Progress progress{};
+            if (journal.find(entry.name, progress))
             {
-                std::cerr << "[x] Failed to create page control: " << ldap_err2string(rc) << std::endl;
-                if (sdControl)
-                {
-                    delete[] sdControl->ldctl_value.bv_val;
-                    delete sdControl;
-                }
-                if (cookie)
-                    ber_bvfree(cookie);
-                ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
-                return -1;
+                resume_point = progress;
+                has_resume_point = true;
             }
+        }
+    }
 
-            LDAPControl *serverControls[] = {sdControl, pageControl, nullptr};
-            LDAPControl **returnedControls = nullptr;
+    Shards::Set shards{shards_directory.value_or(""), static_cast<uint64_t>(std::max(1, Arguments::getValue<int>(arguments, "--shard-size").value_or(64))) << 20, compression, p_stats};
+    if (shards_directory)
+    {
+        if (!shards.open())
+            return 1;
+        for (const auto &entry : objectSearches)
+            shards.add(entry.name);
+    }
 
-            int search_result_code = ldap_search_ext_s(p_ldap, base_dn.c_str(), LDAP_SCOPE_SUBTREE, filter.c_str(), (char **)attributes.data(), 0, serverControls, nullptr, nullptr, 0, &search_result);
+    /* A class goes through a writer of its own into its shards, which are closed once it is done */
+    auto dumpShards{[&shards](const ObjectSearch::Entry &entry, const std::function<int(JSON::Writer &)> &dump)
+                    {
+                        Shards::Class &shard_class{*shards.find(entry.name)};
+                        int result{};
+                        {
+                            JSON::Writer class_writer{&shard_class, JSON::LINES};
+                            result = dump(class_writer);
+                        }
+                        return shard_class.close() ? result : -1;
+                    }};
+
+    /* Left unopened (and never written) when the classes go to shards */
+    Output::File output;
+    if (!shards_directory && !Checkpoint::openAt(output, output_path, has_resume_point ? &resume_point : nullptr))
+    {
+        std::cerr << "[x] Failed to open " << output_path << std::endl;
+        return 1;
+    }
 
-            if (sdControl)
-            {
-                delete[] sdControl->ldctl_value.bv_val;
-                delete sdControl;
-            }
-            if (pageControl)
-            {
-                ldap_control_free(pageControl);
-            }
+    Compression::Stream stream{output, shards_directory ? Compression::Settings{} : compression};
+    JSON::Writer writer{&stream};
+    if (has_resume_point)
+        writer.restore(resume_point.scopes);
+    else if (!shards_directory)
+        writer.beginObject();
+
+    /* Removed only once output.json is complete and the journal gone, until then --resume still needs them */
+    std::vector<std::string> spliced_parts;
 
-            if (search_result_code != LDAP_SUCCESS)
+    if (replay_path)
+    {
+        for (auto &entry : objectSearches)
+        {
+            const Capture::Reader::Class *p_capture_class{reader.find(entry.name)};
+            if (p_capture_class == nullptr)
             {
-                std::cerr << "[x] Search failed for \"" << entry.first << "\": " << ldap_err2string(search_result_code) << std::endl;
-                if (cookie)
-                    ber_bvfree(cookie);
-                if (search_result)
-                    ldap_msgfree(search_result);
-                ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
-                return -1;
+                std::cerr << "[!] The capture holds no \"" << entry.name << "\" search" << std::endl;
+                continue;
             }
 
-            rc = ldap_parse_result(p_ldap, search_result, nullptr, nullptr, nullptr, nullptr, &returnedControls, 0);
-            if (rc == LDAP_SUCCESS && returnedControls != nullptr)
+            if (shards_directory)
             {
-                struct berval *new_cookie = nullptr;
-                ldap_parse_page_control(p_ldap, returnedControls, nullptr, &new_cookie);
+                if (dumpShards(entry, [&](JSON::Writer &class_writer)
+                               { return Dump::replayClass(*p_capture_class, entry, options, class_writer); }) != 0)
+                    return -1;
+                continue;
+            }
 
-                if (cookie)
-                {
-                    ber_bvfree(cookie);
-                    cookie = nullptr;
-                }
+            writer.key(entry.name);
+            if (Dump::replayClass(*p_capture_class, entry, options, writer) != 0)
+                return -1;
+        }
+    }
+    else if (pool.size() == 1)
+    {
+        LDAP *p_ldap{pool.acquire()};
 
-                if (new_cookie != nullptr && new_cookie->bv_len > 0)
-                {
-                    cookie = ber_dupbv(nullptr, new_cookie);
-                }
+        for (auto &entry : objectSearches)
+        {
+            Checkpoint::Progress progress{};
+            bool has_progress{journal.find(entry.name, progress)};
+            if (has_progress && progress.is_done)
+                continue;
 
-                if (new_cookie != nullptr)
-                {
-                    ber_bvfree(new_cookie);
-                }
-                ldap_controls_free(returnedControls);
+            if (shards_directory)
+            {
+                if (dumpShards(entry, [&](JSON::Writer &class_writer)
+                               { return Dump::searchClass(p_ldap, base_dn, entry, options, class_writer); }) != 0)
+                    return -1;
+                continue;
             }
 
-            LDAPMessage *message_entry{ldap_first_entry(p_ldap, search_result)};
+            /* An unfinished class already has its key and part of its array in output.json */
+            if (!has_progress)
+                writer.key(entry.name);
+            if (Dump::searchClass(p_ldap, base_dn, entry, options, writer) != 0)
+                return -1;
+        }
 
-            while (message_entry != nullptr)
-            {
-                std::unique_ptr<JSON::Object> sub_json_object{std::make_unique<JSON::Object>()};
+        pool.release(p_ldap);
+    }
+    else
+    {
+        /* Every class is spilled to its own part file by whichever session is free, then spliced in order */
+        std::vector<const ObjectSearch::Entry *> tasks;
+        for (auto &entry : objectSearches)
+            tasks.push_back(&entry);
+
+        std::vector<int> results(tasks.size(), 0);
+        std::atomic<size_t> next_task{0};
+        std::vector<std::thread> workers;
 
-                for (const auto &attribute : entry.second.attributes)
+        for (size_t i{}; i < std::min(pool.size(), tasks.size()); i++)
+        {
+            workers.emplace_back([&]
+                                 {
+                for (size_t task{next_task++}; task < tasks.size(); task = next_task++)
                 {
-                    berval **values{ldap_get_values_len(p_ldap, message_entry, attribute.name)};
+                    const auto &entry{*tasks[task]};
 
-                    if (values == nullptr)
+                    /* Finished parts are kept as they are, unfinished ones continue where their checkpoint ends */
+                    Checkpoint::Progress progress{};
+                    bool has_progress{journal.find(entry.name, progress)};
+                    if (has_progress && progress.is_done)
                         continue;
 
-                    switch (attribute.type)
+                    /* Shards need no splicing, sessions write them directly */
+                    if (shards_directory)
                     {
-                    case ObjectSearch::AttributeType::STRING:
-                        if (values[0] != nullptr)
-                            sub_json_object->setValue(attribute.name, values[0]->bv_val);
-                        break;
+                        LDAP *p_ldap{pool.acquire()};
+                        results[task] = dumpShards(entry, [&](JSON::Writer &class_writer)
+                                                   { return Dump::searchClass(p_ldap, base_dn, entry, options, class_writer); });
+                        pool.release(p_ldap);
+                        continue;
+                    }
 
-                    case ObjectSearch::AttributeType::MULTI_VALUE:
+                    Output::File part;
+                    if (!Checkpoint::openAt(part, std::string("output.json.") + entry.name + ".part", has_progress ? &progress : nullptr))
                     {
-                        std::vector<JSON::Value> json_values;
-                        for (int i{}; values[i] != nullptr; i++)
-                            json_values.push_back(JSON::Value(JSON::ValueType::STRING, values[i]->bv_val));
-                        sub_json_object->setValue(attribute.name, json_values);
+                        std::cerr << "[x] Failed to open part file for \"" << entry.name << "\"" << std::endl;
+                        results[task] = -1;
+                        continue;
                     }
-                    break;
-
-                    case ObjectSearch::AttributeType::FILETIME:
-                        if (values[0] != nullptr)
-                            sub_json_object->setValue(attribute.name, ObjectSearch::parseFiletime(values[0]));
-                        break;
-
-                    case ObjectSearch::AttributeType::BINARY_SID:
-                        if (values[0] != nullptr)
-                            sub_json_object->setValue(attribute.name, ObjectSearch::parseSid(values[0]));
-                        break;
-
-                    case ObjectSearch::AttributeType::ENUMERATION:
-                        if (values[0] != nullptr)
-                            sub_json_object->setValue(attribute.name, std::stoul(values[0]->bv_val));
-                        break;
-
-                    case ObjectSearch::AttributeType::BINARY_SECURITY_DESCRIPTOR:
-                        if (values[0] != nullptr)
-                            sub_json_object->setValue(attribute.name, ObjectSearch::parseSecurityDescriptor(values[0]));
-                        break;
+
+                    LDAP *p_ldap{pool.acquire()};
+                    {
+                        JSON::Writer part_writer{&part, 1};
+                        if (has_progress)
+                            part_writer.restore(progress.scopes);
+                        results[task] = Dump::searchClass(p_ldap, base_dn, entry, options, part_writer);
                     }
+                    pool.release(p_ldap);
+
+                    /* Not counted as written, the splice into output.json is */
+                    if (!part.close())
+                        results[task] = -1;
+                } });
+        }
+
+        for (auto &worker : workers)
+            worker.join();
 
-                    ldap_value_free_len(values);
+        for (size_t task{}; task < tasks.size(); task++)
+        {
+            std::string part_path{std::string("output.json.") + tasks[task]->name + ".part"};
+
+            if (results[task] != 0)
+            {
+                /* A journaled run keeps its parts for --resume */
+                if (!use_journal)
+                    std::remove(part_path.c_str());
+                return -1;
+            }
+
+            if (shards_directory)
+                continue;
+
+            {
+                std::ifstream part(part_path, std::ios::binary);
+                if (!part)
+                {
+                    std::cerr << "[x] Failed to read part file " << part_path << std::endl;
+                    return -1;
                 }
 
-                objects_array.push_back(JSON::Value(JSON::ValueType::OBJECT, std::move(sub_json_object)));
-                message_entry = ldap_next_entry(p_ldap, message_entry);
+                writer.key(tasks[task]->name);
+                writer.raw(part);
+                if (part.bad())
+                {
+                    std::cerr << "[x] Failed to read part file " << part_path << std::endl;
+                    return -1;
+                }
             }
 
-            ldap_msgfree(search_result);
+            spliced_parts.push_back(part_path);
+        }
+    }
+
+    if (!replay_path)
+        controller.report();
 
-        } while (cookie != nullptr);
+    if (descriptor_cache.usesTable())
+    {
+        writer.key("SECURITY_DESCRIPTORS");
+        descriptor_cache.writeTable(writer);
+    }
+
+    /* Last, the descriptor table above may still intern SIDs */
+    if (use_sid_table)
+    {
+        writer.key("SIDS");
+        sid_table.writeTable(writer);
+    }
 
-        root_json_object->setValue(entry.first, objects_array);
+    if (shards_directory)
+    {
+        if (!shards.writeManifest())
+        {
+            std::cerr << "[x] Failed to write " << *shards_directory << "/manifest.json" << std::endl;
+            return -1;
+        }
+        std::cout << "[*] Shards and their manifest are in " << *shards_directory << std::endl;
+    }
+    else
+    {
+        writer.endObject();
+        writer.flush();
+        bool is_written{stream.close()};
+        is_written = output.close() && is_written;
+        if (p_stats != nullptr)
+            p_stats->onWrite(output.writtenBytes(), output.writeTime());
+        if (!is_written)
+            return -1;
+
+        if (compression_name)
+            std::cout << "[*] Compressed " << stream.size() << " bytes of JSON into " << output.writtenBytes() << " bytes of " << output_path << std::endl;
+    }
+
+    if (record_path && !recorder.close())
+    {
+        std::cerr << "[x] Failed to write capture file " << *record_path << ", it is incomplete" << std::endl;
+        return -1;
+    }
+
+    if (use_journal)
+        journal.remove();
+
+    for (const std::string &part_path : spliced_parts)
+        std::remove(part_path.c_str());
+
+    if (is_lazy)
+    {
+        std::string descriptors_path{std::string("output.descriptors.json") + Compression::extension(compression.format)};
+        std::cout << "[*] " << output_path << " is complete, fetching security descriptors into " << descriptors_path << std::endl;
+        bool is_complete{DescriptorPass::run(pool, base_dn, descriptor_searches, options, descriptors_path, compression)};
+        controller.report();
+        if (!is_complete)
+            return -1;
     }
 
-    std::string stringified_json{root_json_object->toString()};
-    std::ofstream output("output.json", std::ios::trunc | std::ios::binary);
-    output.write(stringified_json.c_str(), stringified_json.size());
-    output.close();
+    std::string server{replay_path ? *replay_path : settings.uri};
+    if (stats_path && !stats.writeJson(*stats_path, server))
+        std::cerr << "[!] Failed to write " << *stats_path << std::endl;
+    if (prometheus_path && !stats.writePrometheus(*prometheus_path, server))
+        std::cerr << "[!] Failed to write " << *prometheus_path << std::endl;
 
-    ldap_unbind_ext_s(p_ldap, nullptr, nullptr);
     return 0;
 }
\ No newline at end of file